@@ -38,6 +38,7 @@
 #include "model.h"
 #include "options.h"
 #include "progress.h"
+#include "reader.h"
 #include "sequence.h"
 #include "tools.h"
 #include "vmath.h"
@@ -120,6 +121,7 @@ static void bcd_flgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 	const double   (*beta )[T][Y]    = (void *)grd_st->beta;
 	const double    *unorm           =         grd_st->unorm;
 	const double    *bnorm           =         grd_st->bnorm;
+	const double     w               =         seq->weight;
 	const uint32_t  *actpos          =         bcd->actpos;
 	const uint32_t   actcnt          =         bcd->actcnt;
 	double *ugrd = bcd->ugrd;
@@ -134,11 +136,11 @@ static void bcd_flgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 			for (uint32_t y = 0; y < Y; y++) {
 				const double e = (*alpha)[t][y] * (*beta)[t][y]
 				               * unorm[t];
-				ugrd[y] += e;
-				uhes[y] += e * (1.0 - e);
+				ugrd[y] += e * w;
+				uhes[y] += e * (1.0 - e) * w;
 			}
 			const uint32_t y = seq->pos[t].lbl;
-			ugrd[y] -= 1.0;
+			ugrd[y] -= w;
 		}
 	}
 	if ((mdl->kind[o] & 2) == 0)
@@ -152,13 +154,13 @@ static void bcd_flgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 			for (uint32_t y = 0; y < Y; y++, d++) {
 				double e = (*alpha)[t - 1][yp] * (*beta)[t][y]
 				         * (*psi)[t][yp][y] * bnorm[t];
-				bgrd[d] += e;
-				bhes[d] += e * (1.0 - e);
+				bgrd[d] += e * w;
+				bhes[d] += e * (1.0 - e) * w;
 			}
 		}
 		const uint32_t yp = seq->pos[t - 1].lbl;
 		const uint32_t y  = seq->pos[t    ].lbl;
-		bgrd[yp * Y + y] -= 1.0;
+		bgrd[yp * Y + y] -= w;
 	}
 }
 
@@ -180,6 +182,7 @@ static void bcd_spgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 	const double   (*beta )[T][Y]  = (void *)grd_st->beta;
 	const double    *unorm         =         grd_st->unorm;
 	const double    *bnorm         =         grd_st->bnorm;
+	const double     w             =         seq->weight;
 	const uint32_t  *actpos        =         bcd->actpos;
 	const uint32_t   actcnt        =         bcd->actcnt;
 	double *ugrd = bcd->ugrd;
@@ -194,11 +197,11 @@ static void bcd_spgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 			for (uint32_t y = 0; y < Y; y++) {
 				const double e = (*alpha)[t][y] * (*beta)[t][y]
 				               * unorm[t];
-				ugrd[y] += e;
-				uhes[y] += e * (1.0 - e);
+				ugrd[y] += e * w;
+				uhes[y] += e * (1.0 - e) * w;
 			}
 			const uint32_t y = seq->pos[t].lbl;
-			ugrd[y] -= 1.0;
+			ugrd[y] -= w;
 		}
 	}
 	if ((mdl->kind[o] & 2) == 0)
@@ -228,13 +231,13 @@ static void bcd_spgradhes(mdl_t *mdl, bcd_t *bcd, const seq_t *seq, uint64_t o)
 		// And use it
 		for (uint32_t yp = 0, d = 0; yp < Y; yp++) {
 			for (uint32_t y = 0; y < Y; y++, d++) {
-				bgrd[d] += e[yp][y];
-				bhes[d] += e[yp][y] * (1.0 - e[yp][y]);
+				bgrd[d] += e[yp][y] * w;
+				bhes[d] += e[yp][y] * (1.0 - e[yp][y]) * w;
 			}
 		}
 		const uint32_t yp = seq->pos[t - 1].lbl;
 		const uint32_t y  = seq->pos[t    ].lbl;
-		bgrd[yp * Y + y] -= 1.0;
+		bgrd[yp * Y + y] -= w;
 	}
 }
 
@@ -294,12 +297,13 @@ void trn_bcd(mdl_t *mdl) {
 	info("    - Build the index\n");
 	info("        1/2 -- scan the sequences\n");
 	uint64_t tot = 0;
+	seq_t *buf = rdr_seqbuf(mdl->train);
 	uint32_t cnt[O], lcl[O];
 	for (uint64_t o = 0; o < O; o++)
 		cnt[o] = 0, lcl[o] = (uint32_t)-1;
 	for (uint32_t s = 0; s < S; s++) {
 		// List actives blocks
-		const seq_t *seq = mdl->train->seq[s];
+		const seq_t *seq = rdr_getseq(mdl->train, s, buf);
 		for (uint32_t t = 0; t < seq->len; t++) {
 			for (uint32_t b = 0; b < seq->pos[t].ucnt; b++)
 				lcl[seq->pos[t].uobs[b]] = s;
@@ -325,7 +329,7 @@ void trn_bcd(mdl_t *mdl) {
 		cnt[o] = 0, lcl[o] = (uint32_t)-1;
 	for (uint32_t s = 0; s < S; s++) {
 		// List actives blocks
-		const seq_t *seq = mdl->train->seq[s];
+		const seq_t *seq = rdr_getseq(mdl->train, s, buf);
 		for (uint32_t t = 0; t < seq->len; t++) {
 			for (uint32_t b = 0; b < seq->pos[t].ucnt; b++)
 				lcl[seq->pos[t].uobs[b]] = s;
@@ -361,7 +365,7 @@ void trn_bcd(mdl_t *mdl) {
 			// Process active sequences
 			for (uint32_t s = 0; s < idx_cnt[o]; s++) {
 				const uint32_t id = idx_lst[o][s];
-				const seq_t *seq = mdl->train->seq[id];
+				const seq_t *seq = rdr_getseq(mdl->train, id, buf);
 				bcd_actpos(mdl, bcd, seq, o);
 				grd_stcheck(bcd->grd_st, seq->len);
 				if (mdl->opt->sparse) {
@@ -386,6 +390,7 @@ void trn_bcd(mdl_t *mdl) {
 	xvm_free(bcd->bgrd); xvm_free(bcd->bhes);
 	free(bcd->actpos);
 	free(bcd);
+	free(buf);
 	for (uint64_t o = 0; o < O; o++)
 		free(idx_lst[o]);
 	free(idx_lst);
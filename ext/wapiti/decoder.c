@@ -431,7 +431,9 @@ void tag_label(mdl_t *mdl, FILE *fin, FILE *fout) {
 		stat[0][y] = stat[1][y] = stat[2][y] = 0;
 	// Next read the input file sequence by sequence and label them, we have
 	// to take care of not discarding the raw input as we want to send it
-	// back to the output with the additional predicted labels.
+	// back to the output with the additional predicted labels. Regular
+	// files are mapped so lines are not copied.
+	rdr_mapin(mdl->reader, fin);
 	while (!feof(fin)) {
 		// So, first read an input sequence keeping the raw_t object
 		// available, and label it with Viterbi.
@@ -455,7 +457,8 @@ void tag_label(mdl_t *mdl, FILE *fin, FILE *fout) {
 				fprintf(fout, "# %d %f\n", (int)n, scs[n]);
 			for (uint32_t t = 0; t < T; t++) {
 				if (!mdl->opt->label)
-					fprintf(fout, "%s\t", raw->lines[t]);
+					fprintf(fout, "%.*s\t", (int)raw->lens[t],
+						raw->lines[t]);
 				uint32_t lbl = out[t * N + n];
 				const char *lblstr = qrk_id2str(lbls, lbl);
 				fprintf(fout, "%s", lblstr);
@@ -505,6 +508,8 @@ void tag_label(mdl_t *mdl, FILE *fin, FILE *fout) {
 			info("\n");
 		}
 	}
+	rdr_unmapin(mdl->reader);
+	rdr_memoinfo(mdl->reader);
 	// If user have provided reference labels, we have collected a lot of
 	// statistics and we can repport global token and sequence error rate as
 	// well as precision recall and f-measure for each labels.
@@ -558,25 +563,31 @@ static void tag_evalsub(job_t *job, uint32_t id, uint32_t cnt, eval_t *eval) {
 	eval->scnt = 0;
 	eval->serr = 0;
 	// We just get a job a process all the squence in it.
+	seq_t *buf = rdr_seqbuf(dat);
 	uint32_t count, pos;
 	while (mth_getjob(job, &count, &pos)) {
-		for (uint32_t s = pos; s < pos + count; s++) {
+		for (uint32_t n = pos; n < pos + count; n++) {
 			// Tag the sequence with the viterbi
-			const seq_t *seq = dat->seq[s];
+			const uint32_t s = dat->ord != NULL ? dat->ord[n] : n;
+			const seq_t *seq = rdr_getseq(dat, s, buf);
 			const uint32_t T = seq->len;
 			uint32_t *out = wapiti_xmalloc(sizeof(uint32_t) * T);
 			tag_viterbi(mdl, seq, out, NULL, NULL);
-			// And check for eventual (probable ?) errors
-			bool err = false;
+			// And check for eventual (probable ?) errors, counting
+			// them as many times as the sequence weight.
+			const uint64_t w = seq->weight;
+			uint64_t errs = 0;
 			for (uint32_t t = 0; t < T; t++)
 				if (seq->pos[t].lbl != out[t])
-					eval->terr++, err = true;
-			eval->tcnt += T;
-			eval->scnt += 1;
-			eval->serr += err;
+					errs++;
+			eval->terr += errs * w;
+			eval->tcnt += T * w;
+			eval->scnt += w;
+			eval->serr += (errs != 0) ? w : 0;
 			free(out);
 		}
 	}
+	free(buf);
 }
 
 /* tag_eval:
@@ -597,8 +608,14 @@ void tag_eval(mdl_t *mdl, double *te, double *se) {
 	}
 	// And next, we call the workers to do the job and reduce the partial
 	// result by summing them and computing the final error rates.
-	mth_spawn((func_t *)tag_evalsub, W, (void *)eval, dat->nseq,
-		mdl->opt->jobsize);
+	// As for the gradient, several workers get the sequences longest first.
+	const uint64_t *cost = NULL;
+	if (W > 1) {
+		rdr_sched(dat);
+		cost = dat->cost;
+	}
+	mdl->wall += mth_spawncost((func_t *)tag_evalsub, W, (void *)eval,
+		dat->nseq, mdl->opt->jobsize, cost, mdl->busy);
 	uint64_t tcnt = 0, terr = 0;
 	uint64_t scnt = 0, serr = 0;
 	for (uint32_t w = 0; w < W; w++) {
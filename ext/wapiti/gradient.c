@@ -36,6 +36,7 @@
 #include "model.h"
 #include "options.h"
 #include "progress.h"
+#include "reader.h"
 #include "sequence.h"
 #include "tools.h"
 #include "thread.h"
@@ -88,6 +89,7 @@ void grd_domaxent(grd_st_t *grd_st, const seq_t *seq) {
 	const double  *x = mdl->theta;
 	const uint32_t T = seq->len;
 	const uint32_t Y = mdl->nlbl;
+	const double   w = seq->weight;
 	double *psi = grd_st->psi;
 	double *g   = grd_st->g;
 	for (uint32_t t = 0; t < T; t++) {
@@ -116,17 +118,19 @@ void grd_domaxent(grd_st_t *grd_st, const seq_t *seq) {
 		//     E_{q_θ}(x,y) - E_{p}(x,y)
 		// and we can compute the expectation over the model with:
 		//     E_{q_θ}(x,y) = f_k(y,x^i) * ψ(y,x) / Z_θ(x)
+		// Both are scaled by the weight of the sequence as if it was
+		// seen as many times.
 		for (uint32_t y = 0; y < Y; y++)
-			psi[y] /= Z;
+			psi[y] = psi[y] / Z * w;
 		for (uint32_t n = 0; n < pos->ucnt; n++) {
 			double *grd = g + mdl->uoff[pos->uobs[n]];
 			for (uint32_t y = 0; y < Y; y++)
 				atm_inc(grd + y, psi[y]);
-			atm_inc(grd + pos->lbl, -1.0);
+			atm_inc(grd + pos->lbl, -w);
 		}
 		// And finally the log-likelihood with:
 		//     L_θ(x^i,y^i) = log(Z_θ(x^i)) - log(ψ(y^i,x^i))
-		grd_st->lloss += log(Z) - lloss;
+		grd_st->lloss += (log(Z) - lloss) * w;
 	}
 }
 
@@ -153,6 +157,7 @@ void grd_domemm(grd_st_t *grd_st, const seq_t *seq) {
 	const double *x  = mdl->theta;
 	const uint32_t T = seq->len;
 	const uint32_t Y = mdl->nlbl;
+	const double   w = seq->weight;
 	double *psi = grd_st->psi;
 	double *g   = grd_st->g;
 	for (uint32_t t = 0; t < T; t++) {
@@ -195,13 +200,15 @@ void grd_domemm(grd_st_t *grd_st, const seq_t *seq) {
 		//     E_{q_θ}(x,y) - E_{p}(x,y)
 		// and we can compute the expectation over the model with:
 		//     E_{q_θ}(x,y) = f_k(y, y,x^i) * ψ(y,x) / Z_θ(x)
+		// Both are scaled by the weight of the sequence as if it was
+		// seen as many times.
 		for (uint32_t y = 0; y < Y; y++)
-			psi[y] /= Z;
+			psi[y] = psi[y] / Z * w;
 		for (uint32_t n = 0; n < pos->ucnt; n++) {
 			double *grd = g + mdl->uoff[pos->uobs[n]];
 			for (uint32_t y = 0; y < Y; y++)
 				atm_inc(grd + y, psi[y]);
-			atm_inc(grd + pos->lbl, -1.0);
+			atm_inc(grd + pos->lbl, -w);
 		}
 		if (t != 0) {
 			const uint32_t yp = seq->pos[t - 1].lbl;
@@ -210,12 +217,12 @@ void grd_domemm(grd_st_t *grd_st, const seq_t *seq) {
 				double *grd = g + mdl->boff[pos->bobs[n]] + d;
 				for (uint32_t y = 0; y < Y; y++)
 					atm_inc(grd + y, psi[y]);
-				atm_inc(grd + pos->lbl, -1.0);
+				atm_inc(grd + pos->lbl, -w);
 			}
 		}
 		// And finally the log-likelihood with:
 		//     L_θ(x^i,y^i) = log(Z_θ(x^i)) - log(ψ(y^i,x^i))
-		grd_st->lloss += log(Z) - lloss;
+		grd_st->lloss += (log(Z) - lloss) * w;
 	}
 }
 
@@ -564,11 +571,12 @@ void grd_flupgrad(grd_st_t *grd_st, const seq_t *seq) {
 	const double (*beta )[T][Y]    = (void *)grd_st->beta;
 	const double  *unorm           =         grd_st->unorm;
 	const double  *bnorm           =         grd_st->bnorm;
+	const double   w               =         seq->weight;
 	double *g = grd_st->g;
 	for (uint32_t t = 0; t < T; t++) {
 		const pos_t *pos = &(seq->pos[t]);
 		for (uint32_t y = 0; y < Y; y++) {
-			double e = (*alpha)[t][y] * (*beta)[t][y] * unorm[t];
+			double e = (*alpha)[t][y] * (*beta)[t][y] * unorm[t] * w;
 			for (uint32_t n = 0; n < pos->ucnt; n++) {
 				const uint64_t o = pos->uobs[n];
 				atm_inc(g + mdl->uoff[o] + y, e);
@@ -580,7 +588,7 @@ void grd_flupgrad(grd_st_t *grd_st, const seq_t *seq) {
 		for (uint32_t yp = 0, d = 0; yp < Y; yp++) {
 			for (uint32_t y = 0; y < Y; y++, d++) {
 				double e = (*alpha)[t - 1][yp] * (*beta)[t][y]
-				         * (*psi)[t][yp][y] * bnorm[t];
+				         * (*psi)[t][yp][y] * bnorm[t] * w;
 				for (uint32_t n = 0; n < pos->bcnt; n++) {
 					const uint64_t o = pos->bobs[n];
 					atm_inc(g + mdl->boff[o] + d, e);
@@ -611,11 +619,12 @@ void grd_spupgrad(grd_st_t *grd_st, const seq_t *seq) {
 	const double   (*beta )[T][Y]  = (void *)grd_st->beta;
 	const double    *unorm         =         grd_st->unorm;
 	const double    *bnorm         =         grd_st->bnorm;
+	const double     w             =         seq->weight;
 	double *g = grd_st->g;
 	for (uint32_t t = 0; t < T; t++) {
 		const pos_t *pos = &(seq->pos[t]);
 		for (uint32_t y = 0; y < Y; y++) {
-			double e = (*alpha)[t][y] * (*beta)[t][y] * unorm[t];
+			double e = (*alpha)[t][y] * (*beta)[t][y] * unorm[t] * w;
 			for (uint32_t n = 0; n < pos->ucnt; n++) {
 				const uint64_t o = pos->uobs[n];
 				atm_inc(g + mdl->uoff[o] + y, e);
@@ -629,7 +638,7 @@ void grd_spupgrad(grd_st_t *grd_st, const seq_t *seq) {
 		for (uint32_t yp = 0; yp < Y; yp++)
 			for (uint32_t y = 0; y < Y; y++)
 				e[yp][y] = (*alpha)[t - 1][yp] * (*beta)[t][y]
-				         * (*psiuni)[t][y] * bnorm[t];
+				         * (*psiuni)[t][y] * bnorm[t] * w;
 		const uint32_t off = psioff[t];
 		for (uint32_t n = 0, y = 0; n < (*psiidx)[t][Y - 1]; ) {
 			while (n >= (*psiidx)[t][y])
@@ -657,17 +666,21 @@ void grd_spupgrad(grd_st_t *grd_st, const seq_t *seq) {
  *   Substract from the gradient, the expectation over the empirical
  *   distribution. This is the second step of the gradient computation shared
  *   by the non-sparse and sparse version.
+ *
+ *   As for the model expectation, all the terms of a sequence are scaled by its
+ *   weight, so a deduplicated sequence count as all its copies.
  */
 void grd_subemp(grd_st_t *grd_st, const seq_t *seq) {
 	const mdl_t *mdl = grd_st->mdl;
 	const uint32_t Y = mdl->nlbl;
 	const uint32_t T = seq->len;
+	const double   w = seq->weight;
 	double *g = grd_st->g;
 	for (uint32_t t = 0; t < T; t++) {
 		const pos_t *pos = &(seq->pos[t]);
 		const uint32_t y = seq->pos[t].lbl;
 		for (uint32_t n = 0; n < pos->ucnt; n++)
-			atm_inc(g + mdl->uoff[pos->uobs[n]] + y, -1.0);
+			atm_inc(g + mdl->uoff[pos->uobs[n]] + y, -w);
 	}
 	for (uint32_t t = 1; t < T; t++) {
 		const pos_t *pos = &(seq->pos[t]);
@@ -675,7 +688,7 @@ void grd_subemp(grd_st_t *grd_st, const seq_t *seq) {
 		const uint32_t y  = seq->pos[t    ].lbl;
 		const uint32_t d  = yp * Y + y;
 		for (uint32_t n = 0; n < pos->bcnt; n++)
-			atm_inc(g + mdl->boff[pos->bobs[n]] + d, -1.0);
+			atm_inc(g + mdl->boff[pos->bobs[n]] + d, -w);
 	}
 }
 
@@ -729,7 +742,7 @@ void grd_logloss(grd_st_t *grd_st, const seq_t *seq) {
 		for (uint32_t n = 0; n < pos->bcnt; n++)
 			lloss -= x[mdl->boff[pos->bobs[n]] + d];
 	}
-	grd_st->lloss += lloss;
+	grd_st->lloss += lloss * seq->weight;
 }
 
 /* grd_docrf:
@@ -922,14 +935,20 @@ void grd_worker(job_t *job, uint32_t id, uint32_t cnt, grd_st_t *grd_st) {
 		grd_st->g[f] = 0.0;
 #endif
 	// Now all is ready, we can process our sequences and accumulate the
-	// gradient and inverse log-likelihood
+	// gradient and inverse log-likelihood. Streamed datasets need a buffer
+	// to rebuild the sequences.
+	// With a schedule, the jobs are positions in its order.
+	seq_t *buf = rdr_seqbuf(dat);
 	uint32_t count, pos;
 	while (mth_getjob(job, &count, &pos)) {
-		for (uint32_t s = pos; !uit_stop && s < pos + count; s++)
-			grd_dospl(grd_st, dat->seq[s]);
+		for (uint32_t n = pos; !uit_stop && n < pos + count; n++) {
+			const uint32_t s = dat->ord != NULL ? dat->ord[n] : n;
+			grd_dospl(grd_st, rdr_getseq(dat, s, buf));
+		}
 		if (uit_stop)
 			break;
 	}
+	free(buf);
 }
 
 /* grd_gradient:
@@ -951,9 +970,16 @@ double grd_gradient(grd_t *grd) {
 	// All is ready to compute the gradient, we spawn the threads of
 	// workers, each one working on a part of the data. As the gradient and
 	// log-likelihood are additive, computing the final values will be
-	// trivial.
-	mth_spawn((func_t *)grd_worker, W, (void **)grd->grd_st,
-		mdl->train->nseq, mdl->opt->jobsize);
+	// trivial. With several workers, the sequences are handed out longest
+	// first by batches of equal cost so they all finish together.
+	const uint64_t *cost = NULL;
+	if (W > 1) {
+		rdr_sched(mdl->train);
+		cost = mdl->train->cost;
+	}
+	mdl->wall += mth_spawncost((func_t *)grd_worker, W,
+		(void **)grd->grd_st, mdl->train->nseq, mdl->opt->jobsize,
+		cost, mdl->busy);
 	if (uit_stop)
 		return -1.0;
 	// All computations are done, it just remain to add all the gradients
@@ -74,6 +74,8 @@ mdl_t *mdl_new(rdr_t *rdr) {
 	mdl->train  = mdl->devel = NULL;
 	mdl->reader = rdr;
 	mdl->werr   = NULL;
+	mdl->busy   = NULL;
+	mdl->wall   = 0.0;
 	return mdl;
 }
 
@@ -95,6 +97,7 @@ void mdl_free(mdl_t *mdl) {
 		rdr_free(mdl->reader);
 	if (mdl->werr != NULL)
 		free(mdl->werr);
+	free(mdl->busy);
 	free(mdl);
 }
 
@@ -119,10 +122,14 @@ void mdl_free(mdl_t *mdl) {
  *   After synchronization, the labels and observations databases are locked to
  *   prevent new one to be created. You must unlock them explicitly if needed.
  *   This reduce the risk of mistakes.
+ *
+ *   With feature hashing, the observations are the buckets of the reader. As
+ *   their strings are not known, their kind is deduced from the patterns.
  */
 void mdl_sync(mdl_t *mdl) {
-	const uint32_t Y = qrk_count(mdl->reader->lbl);
-	const uint64_t O = qrk_count(mdl->reader->obs);
+	const rdr_t *rdr = mdl->reader;
+	const uint32_t Y = qrk_count(rdr->lbl);
+	const uint64_t O = rdr->nbkt != 0 ? rdr->nbkt : qrk_count(rdr->obs);
 	// If model is already synchronized, do nothing and just return
 	if (mdl->nlbl == Y && mdl->nobs == O)
 		return;
@@ -157,13 +164,22 @@ void mdl_sync(mdl_t *mdl) {
 	mdl->boff = boff;
 	// Now, we can setup the features. For each new observations we fill the
 	// kind and offsets arrays and count total number of features as well.
+	char hkind = 3;
+	if (rdr->npats != 0)
+		hkind = (rdr->nuni != 0 ? 1 : 0) | (rdr->nbi != 0 ? 2 : 0);
+	else if (rdr->autouni)
+		hkind = 1;
 	uint64_t F = oldF;
 	for (uint64_t o = oldO; o < O; o++) {
-		const char *obs = qrk_id2str(mdl->reader->obs, o);
-		switch (obs[0]) {
-			case 'u': kind[o] = 1; break;
-			case 'b': kind[o] = 2; break;
-			case '*': kind[o] = 3; break;
+		if (rdr->nbkt != 0) {
+			kind[o] = hkind;
+		} else {
+			const char *obs = qrk_id2str(rdr->obs, o);
+			switch (obs[0]) {
+				case 'u': kind[o] = 1; break;
+				case 'b': kind[o] = 2; break;
+				case '*': kind[o] = 3; break;
+			}
 		}
 		if (kind[o] & 1)
 			uoff[o] = F, F += Y;
@@ -196,8 +212,14 @@ void mdl_sync(mdl_t *mdl) {
  *   zero actives features. On model trained with l1 regularization this can
  *   lead to a drastic model size reduction and so to faster loading, training
  *   and labeling.
+ *   Hashed models cannot be compacted as removing a bucket would change the
+ *   identifiers of all the following ones.
  */
 void mdl_compact(mdl_t *mdl) {
+	if (mdl->reader->nbkt != 0) {
+		warning("cannot compact a hashed model, skipping");
+		return;
+	}
 	const uint32_t Y = mdl->nlbl;
 	// We first build the new observation list with only observations which
 	// lead to at least one active feature. At the same time we build the
@@ -224,6 +246,7 @@ void mdl_compact(mdl_t *mdl) {
 		trans[newo] = oldo;
 	}
 	mdl->reader->obs = new_obs;
+	rdr_dropfid(mdl->reader);
 	// Now we save the old model features informations and build a new one
 	// corresponding to the compacted model.
 	uint64_t *old_uoff  = mdl->uoff;  mdl->uoff  = NULL;
@@ -290,7 +313,7 @@ void mdl_load(mdl_t *mdl, FILE *file) {
 		if (fscanf(file, "#mdl#%"SCNu64"\n", &nact) == 1)
 			mdl->type = 0;
 		else
-			fatal(err);
+			fatal("%s", err);
 	}
 	rdr_load(mdl->reader, file);
 	mdl_sync(mdl);
@@ -298,7 +321,7 @@ void mdl_load(mdl_t *mdl, FILE *file) {
 		uint64_t f;
 		double v;
 		if (fscanf(file, "%"SCNu64"=%le\n", &f, &v) != 2)
-			fatal(err);
+			fatal("%s", err);
 		mdl->theta[f] = v;
 	}
 }
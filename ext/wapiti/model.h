@@ -83,6 +83,10 @@ struct mdl_s {
 	double   *werr;    //       Window of error rate of last iters
 	uint32_t  wcnt;    //       Number of iters in the window
 	uint32_t  wpos;    //       Position for the next iter
+
+	// Workers activity
+	double   *busy;    //  [W]  Time spent working by each thread
+	double    wall;    //       Time spent in the parallel sections
 };
 
 mdl_t *mdl_new(rdr_t *rdr);
@@ -186,6 +186,24 @@ static VALUE options_set_nthread(VALUE self, VALUE rb_fixnum) {
   return rb_fixnum;
 }
 
+static VALUE options_buckets(VALUE self) {
+  return INT2FIX(get_options(self)->buckets);
+}
+
+static VALUE options_set_buckets(VALUE self, VALUE rb_fixnum) {
+  opt_t *options = get_options(self);
+  const int buckets = NUM2INT(rb_fixnum);
+
+  if (buckets < 0) {
+    rb_raise(cArgumentError,
+      "buckets must not be negative (%d given)", buckets);
+  }
+
+  options->buckets = buckets;
+
+  return rb_fixnum;
+}
+
 static VALUE options_histsz(VALUE self) {
   return INT2FIX(get_options(self)->lbfgs.histsz);
 }
@@ -323,6 +341,69 @@ static VALUE options_set_compact(VALUE self, VALUE rb_boolean) {
   return rb_boolean;
 }
 
+static VALUE options_binary(VALUE self) {
+  return get_options(self)->binary ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_binary(VALUE self, VALUE rb_boolean) {
+  get_options(self)->binary = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_mmap(VALUE self) {
+  return get_options(self)->mapped ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_mmap(VALUE self, VALUE rb_boolean) {
+  get_options(self)->mapped = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_perfect(VALUE self) {
+  return get_options(self)->perfect ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_perfect(VALUE self, VALUE rb_boolean) {
+  get_options(self)->perfect = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_tokid(VALUE self) {
+  return get_options(self)->tokid ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_tokid(VALUE self, VALUE rb_boolean) {
+  get_options(self)->tokid = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_stream(VALUE self) {
+  return get_options(self)->stream ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_stream(VALUE self, VALUE rb_boolean) {
+  get_options(self)->stream = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_dedup(VALUE self) {
+  return get_options(self)->dedup ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_dedup(VALUE self, VALUE rb_boolean) {
+  get_options(self)->dedup = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
+static VALUE options_hashed(VALUE self) {
+  return get_options(self)->hashed ? Qtrue : Qfalse;
+}
+
+static VALUE options_set_hashed(VALUE self, VALUE rb_boolean) {
+  get_options(self)->hashed = !(TYPE(rb_boolean) == T_NIL || !rb_boolean);
+  return rb_boolean;
+}
+
 static VALUE options_sparse(VALUE self) {
   return get_options(self)->sparse ? Qtrue : Qfalse;
 }
@@ -472,6 +553,9 @@ void Init_options() {
   rb_define_alias(cOptions, "threads", "nthread");
   rb_define_alias(cOptions, "threads=", "nthread=");
 
+  rb_define_method(cOptions, "buckets", options_buckets, 0);
+  rb_define_method(cOptions, "buckets=", options_set_buckets, 1);
+
   rb_define_method(cOptions, "rho1", options_rho1, 0);
   rb_define_method(cOptions, "rho1=", options_set_rho1, 1);
 
@@ -494,6 +578,41 @@ void Init_options() {
 
   rb_define_alias(cOptions, "compact?", "compact");
 
+  rb_define_method(cOptions, "binary", options_binary, 0);
+  rb_define_method(cOptions, "binary=", options_set_binary, 1);
+
+  rb_define_alias(cOptions, "binary?", "binary");
+
+  rb_define_method(cOptions, "mmap", options_mmap, 0);
+  rb_define_method(cOptions, "mmap=", options_set_mmap, 1);
+
+  rb_define_alias(cOptions, "mmap?", "mmap");
+
+  rb_define_method(cOptions, "perfect", options_perfect, 0);
+  rb_define_method(cOptions, "perfect=", options_set_perfect, 1);
+
+  rb_define_alias(cOptions, "perfect?", "perfect");
+
+  rb_define_method(cOptions, "tokid", options_tokid, 0);
+  rb_define_method(cOptions, "tokid=", options_set_tokid, 1);
+
+  rb_define_alias(cOptions, "tokid?", "tokid");
+
+  rb_define_method(cOptions, "stream", options_stream, 0);
+  rb_define_method(cOptions, "stream=", options_set_stream, 1);
+
+  rb_define_alias(cOptions, "stream?", "stream");
+
+  rb_define_method(cOptions, "dedup", options_dedup, 0);
+  rb_define_method(cOptions, "dedup=", options_set_dedup, 1);
+
+  rb_define_alias(cOptions, "dedup?", "dedup");
+
+  rb_define_method(cOptions, "hashed", options_hashed, 0);
+  rb_define_method(cOptions, "hashed=", options_set_hashed, 1);
+
+  rb_define_alias(cOptions, "hashed?", "hashed");
+
   rb_define_method(cOptions, "sparse", options_sparse, 0);
   rb_define_method(cOptions, "sparse=", options_set_sparse, 1);
 
@@ -725,7 +844,12 @@ static VALUE model_save(int argc, VALUE *argv, VALUE self) {
     fatal("failed to save model: no path given");
   }
 
-  FILE *file = ufopen(path, "w");
+  // A mapped quark must be copied to memory first as we may be about to
+  // truncate the very file it is mapped from.
+  qrk_unmap(model->reader->obs);
+
+  FILE *file = ufopen(path, "wb");
+  model->reader->binary = model->opt->binary;
   mdl_save(model, file);
   fclose(file);
 
@@ -753,14 +877,16 @@ static VALUE model_load(int argc, VALUE *argv, VALUE self) {
     fatal("failed to load model: no path given");
   }
 
-  FILE *file = ufopen(path, "r");
+  FILE *file = ufopen(path, "rb");
+  model->reader->mapped = model->opt->mapped;
   mdl_load(model, file);
   fclose(file);
 
   return self;
 }
 
-static dat_t *to_dat(rdr_t *reader, VALUE data, bool labelled) {
+static dat_t *to_dat(rdr_t *reader, VALUE data, bool labelled,
+    unsigned int threads) {
   Check_Type(data, T_ARRAY);
 
   const unsigned int n = RARRAY_LEN(data);
@@ -769,35 +895,56 @@ static dat_t *to_dat(rdr_t *reader, VALUE data, bool labelled) {
   dat_t *dat = wapiti_xmalloc(sizeof(dat_t));
   dat->nseq = 0;
   dat->mlen = 0;
+  dat->blk = NULL;
+  dat->ord = NULL;
+  dat->cost = NULL;
+  dat->map.addr = NULL;
   dat->lbl = labelled;
   dat->seq = wapiti_xmalloc(sizeof(seq_t*) * n);
 
+  // Collect all the raw sequences first as the Ruby strings can only be
+  // accessed from this thread, the conversion itself is done in parallel.
+  raw_t **raws = wapiti_xmalloc(sizeof(raw_t*) * max(n, 1));
+
   for (i = 0; i < n; ++i) {
     VALUE sequence = rb_ary_entry(data, i);
     Check_Type(sequence, T_ARRAY);
 
     k = RARRAY_LEN(sequence);
-    raw_t *raw = wapiti_xmalloc(sizeof(raw_t) + sizeof(char*) * k);
+    raw_t *raw = rdr_newraw(k);
 
     for (j = 0; j < k; ++j) {
       VALUE line = rb_ary_entry(sequence, j);
       Check_Type(line, T_STRING);
       raw->lines[j] = StringValueCStr(line);
+      raw->lens[j] = RSTRING_LEN(line);
     }
 
-    raw->len = k;
+    raws[i] = raw;
+  }
 
-    seq_t *seq = rdr_raw2seq(reader, raw, labelled);
-    xfree(raw);
+  if (!rdr_raw2seqs(reader, raws, dat->seq, n, labelled, threads)) {
+    for (i = 0; i < n; ++i) {
+      xfree(raws[i]);
+    }
+
+    xfree(raws);
+    rdr_freedat(dat);
 
-    if (seq == 0) { break; }
+    fatal("%s", reader->ws.err);
+  }
 
-    // and store the sequence
-    dat->seq[dat->nseq++] = seq;
-    dat->mlen = max(dat->mlen, seq->len);
+  rdr_memoinfo(reader);
+  dat->nseq = n;
+  rdr_packdat(dat, 0);
 
+  for (i = 0; i < n; ++i) {
+    dat->mlen = max(dat->mlen, dat->seq[i]->len);
+    xfree(raws[i]);
   }
 
+  xfree(raws);
+
   // if no sequence was read, free memory
   if (dat->nseq == 0) {
     xfree(dat->seq);
@@ -809,19 +956,20 @@ static dat_t *to_dat(rdr_t *reader, VALUE data, bool labelled) {
   return dat;
 }
 
-static dat_t *ld_dat(rdr_t *reader, VALUE data, bool labelled) {
+static dat_t *ld_dat(rdr_t *reader, VALUE data, bool labelled,
+    unsigned int threads) {
   FILE *file;
   dat_t *dat = (dat_t*)0;
 
   switch (TYPE(data)) {
     case T_STRING:
       file = ufopen(data, "r");
-      dat = rdr_readdat(reader, file, labelled);
+      dat = rdr_readdat(reader, file, labelled, threads);
       fclose(file);
       break;
 
     case T_ARRAY:
-      dat = to_dat(reader, data, labelled);
+      dat = to_dat(reader, data, labelled, threads);
       break;
 
     default:
@@ -831,21 +979,21 @@ static dat_t *ld_dat(rdr_t *reader, VALUE data, bool labelled) {
   return dat;
 }
 
-
-static VALUE model_train(VALUE self, VALUE train, VALUE devel) {
+// Prepares the reader of a Model before training data is read into it. When
+// fresh data is read, the pattern file is loaded, which unlocks the database
+// if previously locked by loading a model, and the hashed index of the
+// observations is enabled if requested. In all cases, switch to feature
+// hashing if requested. The buckets of a previous model cannot be changed as
+// this would make its weights meaningless.
+static void setup_reader(mdl_t *model, bool fresh, const char *what) {
   FILE *file;
-  mdl_t *model = get_model(self);
-  trn_t trn = trn_get(model->opt->algo);
-  model->type = typ_get(model->opt->type);
 
-  // Load the pattern file. This will unlock the database if previously
-  // locked by loading a model.
-  if (model->opt->pattern) {
+  if (model->opt->pattern && fresh) {
     info("load patterns");
     file = fopen(model->opt->pattern, "r");
 
     if (!file) {
-      pfatal("failed to train model: failed to load pattern file '%s'",
+      pfatal("%s: failed to load pattern file '%s'", what,
         model->opt->pattern);
     }
 
@@ -855,23 +1003,75 @@ static VALUE model_train(VALUE self, VALUE train, VALUE devel) {
     qrk_lock(model->reader->obs, false);
   }
 
+  if (model->opt->buckets && model->opt->buckets != model->reader->nbkt) {
+    if (model->theta) {
+      fatal("%s: cannot change the buckets of a previous model", what);
+    }
+
+    model->reader->nbkt = model->opt->buckets;
+  }
+
+  if (fresh) {
+    qrk_hashed(model->reader->obs, model->opt->hashed);
+  }
+}
+
+static VALUE model_train(VALUE self, VALUE train, VALUE devel) {
+  mdl_t *model = get_model(self);
+  trn_t trn = trn_get(model->opt->algo);
+  model->type = typ_get(model->opt->type);
+
+  // The weights of merged sequences cannot be used by sgd-l1, so fail before
+  // loading anything.
+  if (model->opt->dedup && trn == trn_sgdl1) {
+    fatal("failed to train model: sgd-l1 cannot train on deduplicated sequences");
+  }
+
+  // Without training data, the model is trained again on the dataset it
+  // already holds, as grown by #append, starting from its current weights.
+  if (NIL_P(train)) {
+    if (!model->train || model->train->nseq == 0) {
+      fatal("failed to train model: no training data loaded");
+    }
+  }
+
+  setup_reader(model, !NIL_P(train), "failed to train model");
 
   // Load the training data. When this is done we lock the quarks as we
   // don't want to put in the model, informations present only in the
   // development set.
-  model->train = ld_dat(model->reader, train, true);
+  if (!NIL_P(train)) {
+    if (model->train) {
+      rdr_freedat(model->train);
+      model->train = NULL;
+    }
 
-  qrk_lock(model->reader->lbl, true);
-  qrk_lock(model->reader->obs, true);
+    model->reader->stream = model->opt->stream;
+    model->train = ld_dat(model->reader, train, true, model->opt->nthread);
+    model->reader->stream = false;
+
+    qrk_lock(model->reader->lbl, true);
+    qrk_lock(model->reader->obs, true);
 
-  if (!model->train || model->train->nseq == 0) {
-    fatal("failed to train model: no training data loaded");
+    if (!model->train || model->train->nseq == 0) {
+      fatal("failed to train model: no training data loaded");
+    }
+
+    if (model->opt->dedup) {
+      info("merged %"PRIu32" duplicate sequences",
+        rdr_dedupdat(model->train));
+    }
   }
 
   // If present, load the development set in the model. If not specified,
   // the training dataset will be used instead.
   if (TYPE(devel) != T_NIL) {
-    model->devel = ld_dat(model->reader, devel, true);
+    if (model->devel) {
+      rdr_freedat(model->devel);
+      model->devel = NULL;
+    }
+
+    model->devel = ld_dat(model->reader, devel, true, model->opt->nthread);
   }
 
 	// Initialize the model. If a previous model was loaded, this will be
@@ -898,11 +1098,122 @@ static VALUE model_train(VALUE self, VALUE train, VALUE devel) {
 		mdl_compact(model);
 		info("%8"PRIu64" observations removed", O - model->nobs);
 		info("%8"PRIu64" features removed", F - model->nftr);
+
+    // The observations are renumbered by the compaction so the datasets
+    // cannot be used anymore.
+    rdr_freedat(model->train);
+    model->train = NULL;
+
+    if (model->devel) {
+      rdr_freedat(model->devel);
+      model->devel = NULL;
+    }
+  }
+
+  return self;
+}
+
+// Appends the passed-in training data to the dataset held by the Model
+// from a previous call to #train or #append. New labels and observations
+// are added to the Model's databases and the weights are grown for them,
+// so a following call to #train without data resumes training on the whole
+// dataset from the current weights instead of reloading everything. On a
+// Model which was neither trained nor loaded, the reader is first set up as
+// #train would do.
+static VALUE model_append(VALUE self, VALUE data) {
+  mdl_t *model = get_model(self);
+
+  if (model->train && model->train->map.addr) {
+    fatal("failed to append data: the training data is streamed");
+  }
+
+  if (!model->train && !model->theta) {
+    setup_reader(model, true, "failed to append data");
+  }
+
+  qrk_lock(model->reader->lbl, false);
+  qrk_lock(model->reader->obs, false);
+  dat_t *dat = ld_dat(model->reader, data, true, model->opt->nthread);
+  qrk_lock(model->reader->lbl, true);
+  qrk_lock(model->reader->obs, true);
+
+  if (!dat || dat->nseq == 0) {
+    if (dat) {
+      rdr_freedat(dat);
+    }
+
+    fatal("failed to append data: no training data loaded");
+  }
+
+  const uint32_t n = dat->nseq;
+
+  if (model->train) {
+    rdr_appenddat(model->train, dat);
+  } else {
+    model->train = dat;
+  }
+
+  info("appended %"PRIu32" sequences, nb train: %"PRIu32"", n,
+    model->train->nseq);
+
+  if (model->opt->dedup) {
+    info("merged %"PRIu32" duplicate sequences",
+      rdr_dedupdat(model->train));
+  }
+
+  if (model->theta) {
+    mdl_sync(model);
   }
 
   return self;
 }
 
+// Compiles the passed-in training data into a binary dataset cache at the
+// given path. The data is read with the Model's current options, using a
+// fresh reader so the Model's own databases are left untouched; the cache
+// can then be passed to #train in place of the original data.
+static VALUE model_cache(VALUE self, VALUE data, VALUE path) {
+  FILE *file;
+  mdl_t *model = get_model(self);
+  rdr_t *reader = rdr_new(model->opt->maxent);
+
+  if (model->opt->pattern) {
+    file = fopen(model->opt->pattern, "r");
+
+    if (!file) {
+      rdr_free(reader);
+      pfatal("failed to cache data: failed to load pattern file '%s'",
+        model->opt->pattern);
+    }
+
+    rdr_loadpat(reader, file);
+    fclose(file);
+  }
+
+  reader->nbkt = model->opt->buckets;
+  qrk_hashed(reader->obs, model->opt->hashed);
+
+  dat_t *dat = ld_dat(reader, data, true, model->opt->nthread);
+
+  if (!dat || dat->nseq == 0) {
+    rdr_free(reader);
+    fatal("failed to cache data: no training data loaded");
+  }
+
+  if (model->opt->dedup) {
+    info("merged %"PRIu32" duplicate sequences", rdr_dedupdat(dat));
+  }
+
+  file = ufopen(path, "wb");
+  rdr_savedat(reader, dat, file);
+  fclose(file);
+
+  rdr_freedat(dat);
+  rdr_free(reader);
+
+  return path;
+}
+
 // Returns a sorted list of all labels in the Model's label database.
 static VALUE model_labels(VALUE self) {
   mdl_t *model = get_model(self);
@@ -949,7 +1260,7 @@ static VALUE decode_sequence(VALUE self, mdl_t *model, raw_t *raw) {
     tokens = rb_ary_new();
 
     if (!model->opt->label) {
-      VALUE token = rb_str_new2(raw->lines[t]);
+      VALUE token = rb_str_new(raw->lines[t], raw->lens[t]);
 
       int enc = rb_enc_find_index("UTF-8");
       rb_enc_associate_index(token, enc);
@@ -1040,13 +1351,13 @@ static VALUE decode_sequence_array(VALUE self, VALUE array) {
     Check_Type(sequence, T_ARRAY);
 
     const unsigned int k = RARRAY_LEN(sequence);
-    raw = wapiti_xmalloc(sizeof(raw_t) + sizeof(char*) * k);
-    raw->len = k;
+    raw = rdr_newraw(k);
 
     for (j = 0; j < k; ++j) {
       VALUE line = rb_ary_entry(sequence, j);
       Check_Type(line, T_STRING);
       raw->lines[j] = StringValueCStr(line);
+      raw->lens[j] = RSTRING_LEN(line);
     }
 
     rb_ary_push(result, decode_sequence(self, model, raw));
@@ -1066,7 +1377,10 @@ static VALUE decode_sequence_file(VALUE self, VALUE path) {
 
   // Next read the input file sequence by sequence and label them, we have
   // to take care of not discarding the raw input as we want to send it
-  // back to the output with the additional predicted labels.
+  // back to the output with the additional predicted labels. Regular
+  // files are mapped so lines are not copied.
+  rdr_mapin(model->reader, file);
+
   while (!feof(file)) {
     // So, first read an input sequence keeping the raw_t object
     // available, and label it with Viterbi.
@@ -1078,6 +1392,8 @@ static VALUE decode_sequence_file(VALUE self, VALUE path) {
     rdr_freeraw(raw);
   }
 
+  rdr_unmapin(model->reader);
+
   return result;
 }
 
@@ -1087,6 +1403,16 @@ static VALUE decode_sequence_file(VALUE self, VALUE path) {
 //
 static VALUE model_label(VALUE self, VALUE data) {
   VALUE result = (VALUE)0;
+  mdl_t *model = get_model(self);
+
+  // The index is only built once and is dropped by the quark itself if new
+  // observations are added by a later training.
+  qrk_perfect(model->reader->obs, model->opt->perfect);
+
+  // Token identifiers are only used for this call so later training loads
+  // are not affected.
+  const bool tokid = model->reader->tokid;
+  model->reader->tokid = model->opt->tokid;
 
   switch (TYPE(data)) {
     case T_STRING:
@@ -1099,6 +1425,9 @@ static VALUE model_label(VALUE self, VALUE data) {
       fatal("failed to label data: invalid data (expected type String or Array)");
   }
 
+  rdr_memoinfo(model->reader);
+  model->reader->tokid = tokid;
+
   return result;
 }
 
@@ -1119,6 +1448,8 @@ static void Init_model() {
   rb_define_method(cModel, "save", model_save, -1);
   rb_define_method(cModel, "load", model_load, -1);
   rb_define_method(cModel, "train", model_train, 2);
+  rb_define_method(cModel, "cache", model_cache, 2);
+  rb_define_method(cModel, "append", model_append, 1);
   rb_define_method(cModel, "label", model_label, 1);
 }
 
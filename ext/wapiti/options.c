@@ -67,6 +67,11 @@ static void opt_help(const char *pname) {
 		"\t   | --rstate   FILE    optimizer state to restore\n"
 		"\t   | --sstate   FILE    optimizer state to save\n"
 		"\t-c | --compact          compact model after training\n"
+		"\t   | --binary           save model in binary form\n"
+		"\t   | --hashed           intern observations in a hash table\n"
+		"\t   | --buckets  INT     hash observations in INT buckets\n"
+		"\t   | --stream           stream dataset cache from disk\n"
+		"\t   | --dedup            merge identical training sequences\n"
 		"\t-t | --nthread  INT     number of worker threads\n"
 		"\t-j | --jobsize  INT     job size for worker threads\n"
 		"\t-s | --sparse           enable sparse forward/backward\n"
@@ -92,6 +97,9 @@ static void opt_help(const char *pname) {
 		"    %1$s label [options] [input data] [output data]\n"
 		"\t   | --me               force maxent mode\n"
 		"\t-m | --model    FILE    model file to load\n"
+		"\t   | --mmap             map binary model read-only\n"
+		"\t   | --perfect          index observations by perfect hash\n"
+		"\t   | --tokid            map observations by token identifiers\n"
 		"\t-l | --label            output only labels\n"
 		"\t-c | --check            input is already labeled\n"
 		"\t-s | --score            add scores to output\n"
@@ -108,6 +116,15 @@ static void opt_help(const char *pname) {
 		"    %1$s update [options] [patch file] [output model]\n"
 		"\t-m | --model    FILE    model file to load\n"
 		"\t-c | --compact          compact model after training\n"
+		"\t   | --binary           save model in binary form\n"
+		"\n"
+		"Cache mode\n"
+		"    %1$s cache [options] [input data] [output cache]\n"
+		"\t   | --me               force maxent mode\n"
+		"\t-p | --pattern  FILE    patterns for extracting features\n"
+		"\t   | --buckets  INT     hash observations in INT buckets\n"
+		"\t   | --dedup            merge identical sequences\n"
+		"\t-t | --nthread  INT     number of worker threads\n"
 	;
 	fprintf(stderr, msg, pname);
 }
@@ -119,10 +136,13 @@ const opt_t opt_defaults = {
 	.mode    = -1,
 	.input   = NULL,     .output  = NULL,
 	.type    = "crf",
-	.maxent  = false,
+	.maxent  = false,    .mapped  = false, .perfect = false,
+	.tokid   = false,
 	.algo    = "l-bfgs", .pattern = NULL,  .model   = NULL, .devel   = NULL,
 	.rstate  = NULL,     .sstate  = NULL,
-	.compact = false,    .sparse  = false,
+	.compact = false,    .sparse  = false, .binary  = false,
+	.hashed  = false,    .buckets = 0,     .stream  = false,
+	.dedup   = false,
 	.nthread = 1,        .jobsize = 64,    .maxiter = 0,
 	.rho1    = 0.5,      .rho2    = 0.0001,
 	.objwin  = 5,        .stopwin = 5,     .stopeps = 0.02,
@@ -156,6 +176,11 @@ struct {
 	{0, "##", "--rstate",  'S', offsetof(opt_t, rstate      )},
 	{0, "##", "--sstate",  'S', offsetof(opt_t, sstate      )},
 	{0, "-c", "--compact", 'B', offsetof(opt_t, compact     )},
+	{0, "##", "--binary",  'B', offsetof(opt_t, binary      )},
+	{0, "##", "--hashed",  'B', offsetof(opt_t, hashed      )},
+	{0, "##", "--buckets", 'U', offsetof(opt_t, buckets     )},
+	{0, "##", "--stream",  'B', offsetof(opt_t, stream      )},
+	{0, "##", "--dedup",   'B', offsetof(opt_t, dedup       )},
 	{0, "-s", "--sparse",  'B', offsetof(opt_t, sparse      )},
 	{0, "-t", "--nthread", 'U', offsetof(opt_t, nthread     )},
 	{0, "-j", "--jobsize", 'U', offsetof(opt_t, jobsize     )},
@@ -178,6 +203,9 @@ struct {
 	{0, "##", "--cutoff",  'B', offsetof(opt_t, rprop.cutoff)},
 	{1, "##", "--me",      'B', offsetof(opt_t, maxent      )},
 	{1, "-m", "--model",   'S', offsetof(opt_t, model       )},
+	{1, "##", "--mmap",    'B', offsetof(opt_t, mapped      )},
+	{1, "##", "--perfect", 'B', offsetof(opt_t, perfect     )},
+	{1, "##", "--tokid",   'B', offsetof(opt_t, tokid       )},
 	{1, "-l", "--label",   'B', offsetof(opt_t, label       )},
 	{1, "-c", "--check",   'B', offsetof(opt_t, check       )},
 	{1, "-s", "--score",   'B', offsetof(opt_t, outsc       )},
@@ -188,6 +216,12 @@ struct {
 	{2, "##", "--all",     'B', offsetof(opt_t, all         )},
 	{3, "-m", "--model",   'S', offsetof(opt_t, model       )},
 	{3, "-c", "--compact", 'B', offsetof(opt_t, compact     )},
+	{3, "##", "--binary",  'B', offsetof(opt_t, binary      )},
+	{4, "##", "--me",      'B', offsetof(opt_t, maxent      )},
+	{4, "-p", "--pattern", 'S', offsetof(opt_t, pattern     )},
+	{4, "##", "--buckets", 'U', offsetof(opt_t, buckets     )},
+	{4, "##", "--dedup",   'B', offsetof(opt_t, dedup       )},
+	{4, "-t", "--nthread", 'U', offsetof(opt_t, nthread     )},
 	{-1, NULL, NULL, '\0', 0}
 };
 
@@ -222,6 +256,8 @@ void opt_parse(int argc, char *argv[argc], opt_t *opt) {
 		opt->mode = 2;
 	} else if (!strcmp(argv[0], "u") || !strcmp(argv[0], "update")) {
 		opt->mode = 3;
+	} else if (!strcmp(argv[0], "c") || !strcmp(argv[0], "cache")) {
+		opt->mode = 4;
 	} else {
 		fatal("unknown mode <%s>", argv[0]);
 	}
@@ -41,12 +41,17 @@ struct opt_s {
 	int       mode;
 	char     *input,  *output;
 	bool      maxent;
+	bool      mapped,  perfect;
+	bool      tokid;
 	// Options for training
 	const char     *type;
 	const char     *algo,   *pattern;
 	char     *model,  *devel;
 	char     *rstate, *sstate;
 	bool      compact, sparse;
+	bool      binary,  hashed;
+	bool      stream,  dedup;
+	uint32_t  buckets;
 	uint32_t  nthread;
 	uint32_t  jobsize;
 	uint32_t  maxiter;
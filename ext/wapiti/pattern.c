@@ -59,92 +59,193 @@
  *       *  -> match any number of repetition of the previous character
  *       ?  -> optionally match the previous character
  *
- *   This subset is implemented quite efficiently using recursion. All recursive
- *   calls are tail-call so they should be optimized by the compiler. As we do
- *   direct interpretation, we have to backtrack so performance can be very poor
- *   on specialy designed regexp. This is not a problem as the regexp as well as
- *   the string is expected to be very simple here. If this is not the case, you
- *   better have to prepare your data better.
+ *   A regexp is so just a list of atoms, each one a set of characters with an
+ *   optional repetition, and is compiled once with its pattern. Each atom get
+ *   a 256 entries table of the characters it match, so matching a character is
+ *   a single lookup whatever the class is.
+ *
+ *   The match returned is the leftmost one and, from there, the first found by
+ *   a backtracking matcher trying the fewest repetitions first for '*' and the
+ *   character first for '?'. This is what a Pike virtual machine compute in a
+ *   single pass over the string: the threads are kept in priority order, a new
+ *   one starting at each position with the lowest priority, and a thread
+ *   reaching the end of the regexp cut all the lower priority ones. When only
+ *   the existence of a match is needed, and the regexp has less than 64 atoms,
+ *   the set of states is instead kept in a bit mask and updated with a few
+ *   logical operations per character, the shift-and algorithm. This is much
+ *   cheaper so it is also used to reject the strings without match before
+ *   running the virtual machine. In both cases the time is linear in the
+ *   length of the string.
  ******************************************************************************/
 
-/* rex_matchit:
- *   Match a single caracter at the start fo the string. The character might be
- *   a plain char, a dot or char class.
+/* rex_t:
+ *   A compiled regular expression made of <natm> atoms. Each atom match the
+ *   characters set in <set> once, or any number of times if <rep> is '*', or
+ *   optionally if it is '?'.
+ *   For the shift-and matcher, state i means that the first i atoms matched.
+ *   <tbl> give for each character the mask of atoms matching it, <skip> the
+ *   atoms which can match nothing and <star> the ones which can be repeated.
  */
-static bool rex_matchit(const char *ch, const char *str) {
-	if (str[0] == '\0')
-		return false;
-	if (ch[0] == '.')
-		return true;
-	if (ch[0] == '\\') {
-		switch (ch[1]) {
-			case 'a': return  isalpha(str[0]);
-			case 'd': return  isdigit(str[0]);
-			case 'l': return  islower(str[0]);
-			case 'p': return  ispunct(str[0]);
-			case 's': return  isspace(str[0]);
-			case 'u': return  isupper(str[0]);
-			case 'w': return  isalnum(str[0]);
-			case 'A': return !isalpha(str[0]);
-			case 'D': return !isdigit(str[0]);
-			case 'L': return !islower(str[0]);
-			case 'P': return !ispunct(str[0]);
-			case 'S': return !isspace(str[0]);
-			case 'U': return !isupper(str[0]);
-			case 'W': return !isalnum(str[0]);
-		}
-		return ch[1] == str[0];
+typedef struct rex_atm_s rex_atm_t;
+struct rex_s {
+	bool      bol, eol;   //      Anchored at start or end of string
+	uint32_t  natm;       //  N   Number of atoms
+	uint64_t  skip;       //      Atoms which can match nothing
+	uint64_t  star;       //      Atoms which can be repeated
+	uint64_t  tbl[256];   //      Atoms matching each character
+	struct rex_atm_s {
+		char      rep;    //      Repetition: '\0', '*' or '?'
+		bool      set[256];
+	} atm[];
+};
+
+/* rex_class:
+ *   Check if the character <c> is in the class <cls> of an escape sequence.
+ *   Unknown classes are escaped characters which just match themselves.
+ */
+static bool rex_class(char cls, int c) {
+	switch (cls) {
+		case 'a': return  isalpha(c);
+		case 'd': return  isdigit(c);
+		case 'l': return  islower(c);
+		case 'p': return  ispunct(c);
+		case 's': return  isspace(c);
+		case 'u': return  isupper(c);
+		case 'w': return  isalnum(c);
+		case 'A': return !isalpha(c);
+		case 'D': return !isdigit(c);
+		case 'L': return !islower(c);
+		case 'P': return !ispunct(c);
+		case 'S': return !isspace(c);
+		case 'U': return !isupper(c);
+		case 'W': return !isalnum(c);
 	}
-	return ch[0] == str[0];
+	return c == (unsigned char)cls;
 }
 
-/* rex_matchme:
- *   Match a regular expresion at the start of the string. If a match is found,
- *   is length is returned in len. The mathing is done through tail-recursion
- *   for good performances.
+/* rex_comp:
+ *   Compile a regular expression. A '*' or '?' which doesn't follow a
+ *   character to repeat is rejected.
  */
-static bool rex_matchme(const char *re, const char *str, uint32_t *len) {
-	// Special check for end of regexp
-	if (re[0] == '\0')
-		return true;
-	if (re[0] == '$' && re[1] == '\0')
-		return (str[0] == '\0');
-	// Get first char of regexp
-	const char *ch  = re;
-	const char *nxt = re + 1 + (ch[0] == '\\');
-	// Special check for the following construct "x**" where the first star
-	// is consumed normally but lead the second (which is wrong) to be
-	// interpreted as a char to mach as if it was escaped (and same for the
-	// optional construct)
-	if (*ch == '*' || *ch == '?')
-		fatal("unescaped * or ? in regexp: %s", re);
-	// Handle star repetition
-	if (nxt[0] == '*') {
-		nxt++;
-		do {
-			const uint32_t save = *len;
-			if (rex_matchme(nxt, str, len))
-				return true;
-			*len = save + 1;
-		} while (rex_matchit(ch, str++));
-		return false;
+static rex_t *rex_comp(const char *re) {
+	const uint32_t size = strlen(re);
+	rex_t *rex = wapiti_xmalloc(sizeof(rex_t) + sizeof(rex_atm_t) * size);
+	rex->bol  = false;
+	rex->eol  = false;
+	rex->natm = 0;
+	const char *p = re;
+	if (*p == '^')
+		rex->bol = true, p++;
+	while (*p != '\0') {
+		if (p[0] == '$' && p[1] == '\0') {
+			rex->eol = true;
+			break;
+		}
+		if (*p == '*' || *p == '?')
+			fatal("unescaped * or ? in regexp: %s", p);
+		rex_atm_t *atm = &rex->atm[rex->natm++];
+		atm->set[0] = false;
+		for (int c = 1; c < 256; c++) {
+			if (p[0] == '.')
+				atm->set[c] = true;
+			else if (p[0] == '\\')
+				atm->set[c] = rex_class(p[1], c);
+			else
+				atm->set[c] = (c == (unsigned char)p[0]);
+		}
+		if (p[0] == '\\' && p[1] == '\0')
+			fatal("unended escape in regexp: %s", re);
+		p += (p[0] == '\\') ? 2 : 1;
+		atm->rep = '\0';
+		if (*p == '*' || *p == '?')
+			atm->rep = *p++;
 	}
-	// Handle optional
-	if (nxt[0] == '?') {
-		nxt++;
-		if (rex_matchit(ch, str)) {
-			(*len)++;
-			if (rex_matchme(nxt, str + 1, len))
-				return true;
-			(*len)--;
+	// Build the tables of the shift-and matcher if the states fit in a
+	// mask.
+	rex->skip = rex->star = 0;
+	for (int c = 0; c < 256; c++)
+		rex->tbl[c] = 0;
+	if (rex->natm < 64) {
+		for (uint32_t a = 0; a < rex->natm; a++) {
+			const rex_atm_t *atm = &rex->atm[a];
+			const uint64_t bit = (uint64_t)1 << a;
+			if (atm->rep != '\0')
+				rex->skip |= bit;
+			if (atm->rep == '*')
+				rex->star |= bit;
+			for (int c = 0; c < 256; c++)
+				if (atm->set[c])
+					rex->tbl[c] |= bit;
 		}
-		return rex_matchme(nxt, str, len);
 	}
-	// Classical char matching
-	(*len)++;
-	if (rex_matchit(ch, str))
-		return rex_matchme(nxt, str + 1, len);
-	return false;
+	return rex;
+}
+
+/* rex_closure:
+ *   Extend a set of states of the shift-and matcher with the states reachable
+ *   by skipping optional atoms.
+ */
+static inline uint64_t rex_closure(const rex_t *rex, uint64_t st) {
+	uint64_t nxt = st | ((st & rex->skip) << 1);
+	while (nxt != st) {
+		st  = nxt;
+		nxt = st | ((st & rex->skip) << 1);
+	}
+	return st;
+}
+
+/* rex_test:
+ *   Check with the shift-and matcher if the regexp match somewhere in the
+ *   string. The regexp must have less than 64 atoms.
+ */
+static bool rex_test(const rex_t *rex, const char *str) {
+	const uint64_t fin = (uint64_t)1 << rex->natm;
+	uint64_t st = rex_closure(rex, 1);
+	for (const unsigned char *s = (const unsigned char *)str; *s; s++) {
+		if ((st & fin) && !rex->eol)
+			return true;
+		const uint64_t m = rex->tbl[*s];
+		st = ((st & m) << 1) | (st & m & rex->star);
+		if (!rex->bol)
+			st |= 1;
+		else if (st == 0)
+			return false;
+		st = rex_closure(rex, st);
+	}
+	return (st & fin) != 0;
+}
+
+/* rex_thr_t:
+ *   A thread of the Pike virtual machine: the number of atoms already matched
+ *   and the position where the match started.
+ */
+typedef struct rex_thr_s rex_thr_t;
+struct rex_thr_s {
+	uint32_t atm;
+	uint32_t beg;
+};
+
+/* rex_addthr:
+ *   Add a thread in state <a> to the list, with its followers in priority
+ *   order: the one skipping the atom first for '*' and last for '?'. States
+ *   already in the list this step are not added again as the thread already
+ *   there has an higher priority.
+ */
+static void rex_addthr(const rex_t *rex, rex_thr_t *lst, uint32_t *cnt,
+                       uint32_t *seen, uint32_t gen, uint32_t a,
+                       uint32_t beg) {
+	while (true) {
+		if (seen[a] == gen)
+			return;
+		seen[a] = gen;
+		const char rep = (a < rex->natm) ? rex->atm[a].rep : '\0';
+		if (rep == '*')
+			rex_addthr(rex, lst, cnt, seen, gen, a + 1, beg);
+		lst[(*cnt)++] = (rex_thr_t){a, beg};
+		if (rep != '?')
+			return;
+		a++;
+	}
 }
 
 /* rex_match:
@@ -152,23 +253,277 @@ static bool rex_matchme(const char *re, const char *str, uint32_t *len) {
  *   position of the start of the match is returned and is len is returned in
  *   len, else -1 is returned.
  */
-static int32_t rex_match(const char *re, const char *str, uint32_t *len) {
-	// Special case for anchor at start
-	if (*re == '^') {
-		*len = 0;
-		if (rex_matchme(re + 1, str, len))
-			return 0;
+static int32_t rex_match(const rex_t *rex, const char *str, uint32_t *len) {
+	const uint32_t N = rex->natm;
+	if (N < 64 && !rex_test(rex, str))
 		return -1;
+	rex_thr_t thr[2][N + 1];
+	uint32_t  cnt[2] = {0, 0};
+	uint32_t  seen[N + 1];
+	for (uint32_t a = 0; a <= N; a++)
+		seen[a] = 0;
+	int32_t res = -1;
+	uint32_t gen = 1, cur = 0;
+	for (uint32_t pos = 0; ; pos++) {
+		// Start a new thread here with the lowest priority, unless a
+		// match was already found as it would be on the right.
+		if (res == -1 && (pos == 0 || !rex->bol))
+			rex_addthr(rex, thr[cur], &cnt[cur], seen, gen, 0, pos);
+		if (cnt[cur] == 0)
+			break;
+		const unsigned char c = str[pos];
+		const uint32_t nxt = cur ^ 1;
+		cnt[nxt] = 0;
+		gen++;
+		for (uint32_t t = 0; t < cnt[cur]; t++) {
+			const rex_thr_t *th = &thr[cur][t];
+			if (th->atm == N) {
+				if (rex->eol && c != '\0')
+					continue;
+				res  = th->beg;
+				*len = pos - th->beg;
+				break;
+			}
+			if (c == '\0' || !rex->atm[th->atm].set[c])
+				continue;
+			const uint32_t a = th->atm + (rex->atm[th->atm].rep != '*');
+			rex_addthr(rex, thr[nxt], &cnt[nxt], seen, gen, a, th->beg);
+		}
+		if (c == '\0')
+			break;
+		cur = nxt;
+	}
+	return res;
+}
+
+/* rex_free:
+ *   Free a compiled regular expression.
+ */
+static void rex_free(rex_t *rex) {
+	free(rex);
+}
+
+/*******************************************************************************
+ * Memoization of regexp results
+ *
+ *   Real corpora repeat the same tokens again and again, and the result of a
+ *   't' or 'm' command only depend on the token it is applied on. So instead
+ *   of running the matcher for each occurrence, results are kept in a memo
+ *   table. Commands with the same type and regexp, like the usual ones testing
+ *   the previous, current and next tokens, share a slot numbered by pat_slots
+ *   so they are computed only once per token.
+ *
+ *   The table is keyed by a copy of the token and each entry hold a row with
+ *   the results of all the slots, filled as they are requested. This keep the
+ *   table small enough to stay in cache as it grow with the vocabulary and not
+ *   with the number of commands. It use open addressing with linear probing
+ *   and double when three-quarter full. The table, the rows and the copies of
+ *   the tokens must fit in PAT_MEMOBYTES, so the number of entries allowed
+ *   shrink as the number of slots grow. Once the table cannot grow anymore it
+ *   is just flushed so memory stay bounded on very large vocabularies. Memos
+ *   are not shared between threads, each reader keep its own one in its
+ *   workspace.
+ ******************************************************************************/
+
+/* pat_ent_t:
+ *   An entry of the memo table: the token, as an offset of its copy, and the
+ *   row holding its results.
+ */
+struct pat_ent_s {
+	uint64_t hash;    // Hash of the token
+	size_t   key;     // Offset of the copy of the token in <chr>
+	uint32_t row;     // Row of results, or -1 if the slot is empty
+};
+
+#define PAT_MEMOMIN   (1 << 10)
+#define PAT_MEMOBYTES (8 << 20)
+#define PAT_UNKNOWN (-2)
+
+/* pat_slots:
+ *   Number the regexps of the 't' and 'm' commands of the given patterns so
+ *   the ones with the same type and regexp share the same memo slot. Return
+ *   the number of slots used.
+ */
+uint32_t pat_slots(pat_t **pats, uint32_t npats) {
+	uint32_t nslot = 0;
+	for (uint32_t p = 0; p < npats; p++) {
+		for (uint32_t i = 0; i < pats[p]->nitems; i++) {
+			pat_item_t *item = &pats[p]->items[i];
+			if (item->type != 't' && item->type != 'm')
+				continue;
+			item->slot = nslot;
+			for (uint32_t q = 0; q <= p && item->slot == nslot; q++) {
+				const uint32_t n = q == p ? i : pats[q]->nitems;
+				for (uint32_t j = 0; j < n; j++) {
+					const pat_item_t *o = &pats[q]->items[j];
+					if (o->type == item->type
+					 && !strcmp(o->value, item->value)) {
+						item->slot = o->slot;
+						break;
+					}
+				}
+			}
+			if (item->slot == nslot)
+				nslot++;
+		}
+	}
+	return nslot;
+}
+
+/* pat_memonew:
+ *   Create a new empty memo table for <nslot> regexps slots as numbered by
+ *   pat_slots.
+ */
+pat_memo_t *pat_memonew(uint32_t nslot) {
+	pat_memo_t *memo = wapiti_xmalloc(sizeof(pat_memo_t));
+	memo->nslot = nslot;
+	memo->size  = PAT_MEMOMIN;
+	memo->used  = 0;
+	memo->ent   = wapiti_xmalloc(sizeof(pat_ent_t) * memo->size);
+	for (uint32_t i = 0; i < memo->size; i++)
+		memo->ent[i].row = (uint32_t)-1;
+	memo->res   = wapiti_xmalloc(sizeof(int32_t) * 2 * nslot * memo->size);
+	memo->csize = 4096;
+	memo->cpos  = 0;
+	memo->chr   = wapiti_xmalloc(memo->csize);
+	memo->hit   = 0;
+	memo->miss  = 0;
+	return memo;
+}
+
+/* pat_memobytes:
+ *   Return the memory used by a memo table of <size> entries with <csize> bytes
+ *   of token copies.
+ */
+static size_t pat_memobytes(const pat_memo_t *memo, uint32_t size,
+                            size_t csize) {
+	const size_t ent = sizeof(pat_ent_t) + sizeof(int32_t) * 2 * memo->nslot;
+	return ent * size + csize;
+}
+
+/* pat_memoflush:
+ *   Remove all the entries of the table, keeping its memory.
+ */
+static void pat_memoflush(pat_memo_t *memo) {
+	for (uint32_t i = 0; i < memo->size; i++)
+		memo->ent[i].row = (uint32_t)-1;
+	memo->used = 0;
+	memo->cpos = 0;
+}
+
+/* pat_memofree:
+ *   Free all memory used by a memo table.
+ */
+void pat_memofree(pat_memo_t *memo) {
+	free(memo->ent);
+	free(memo->res);
+	free(memo->chr);
+	free(memo);
+}
+
+/* pat_memogrow:
+ *   Make room in the table for a new entry, either by doubling its size or by
+ *   flushing it if the doubled table would not fit in the memory budget.
+ */
+static void pat_memogrow(pat_memo_t *memo) {
+	const uint32_t size = memo->size * 2;
+	if (pat_memobytes(memo, size, memo->csize) > PAT_MEMOBYTES) {
+		pat_memoflush(memo);
+		return;
+	}
+	pat_ent_t *ent = wapiti_xmalloc(sizeof(pat_ent_t) * size);
+	for (uint32_t i = 0; i < size; i++)
+		ent[i].row = (uint32_t)-1;
+	for (uint32_t i = 0; i < memo->size; i++) {
+		if (memo->ent[i].row == (uint32_t)-1)
+			continue;
+		uint32_t n = memo->ent[i].hash & (size - 1);
+		while (ent[n].row != (uint32_t)-1)
+			n = (n + 1) & (size - 1);
+		ent[n] = memo->ent[i];
+	}
+	free(memo->ent);
+	memo->ent  = ent;
+	memo->size = size;
+	memo->res  = wapiti_xrealloc(memo->res,
+		sizeof(int32_t) * 2 * memo->nslot * size);
+}
+
+/* pat_memorow:
+ *   Return the row of results of the given token, adding it to the table with
+ *   all its results unknown if not already there.
+ */
+static int32_t *pat_memorow(pat_memo_t *memo, const char *str) {
+	const uint64_t prm = 0x100000001b3ULL;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t size = 0;
+	for ( ; str[size] != '\0'; size++)
+		h = (h ^ (uint8_t)str[size]) * prm;
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	const uint32_t R = memo->nslot;
+	uint32_t n = h & (memo->size - 1);
+	for ( ; memo->ent[n].row != (uint32_t)-1; n = (n + 1) & (memo->size - 1)) {
+		const pat_ent_t *ent = &memo->ent[n];
+		if (ent->hash == h && !memcmp(memo->chr + ent->key, str, size + 1))
+			return memo->res + (size_t)ent->row * R * 2;
+	}
+	// Not found, so add the token to the table, making room for it first
+	// if needed.
+	if ((memo->used + 1) * 4 > memo->size * 3) {
+		pat_memogrow(memo);
+		n = h & (memo->size - 1);
+		while (memo->ent[n].row != (uint32_t)-1)
+			n = (n + 1) & (memo->size - 1);
+	}
+	if (memo->cpos + size + 1 > memo->csize) {
+		size_t csize = memo->csize;
+		while (memo->cpos + size + 1 > csize)
+			csize *= 2;
+		// If the copies would overflow the budget, flush the table
+		// instead, it only has to grow if the token itself is too long.
+		if (pat_memobytes(memo, memo->size, csize) > PAT_MEMOBYTES) {
+			pat_memoflush(memo);
+			n = h & (memo->size - 1);
+			csize = memo->csize;
+			while (size + 1 > csize)
+				csize *= 2;
+		}
+		if (csize != memo->csize) {
+			memo->csize = csize;
+			memo->chr = wapiti_xrealloc(memo->chr, csize);
+		}
+	}
+	memcpy(memo->chr + memo->cpos, str, size + 1);
+	memo->ent[n] = (pat_ent_t){h, memo->cpos, memo->used};
+	memo->cpos += size + 1;
+	int32_t *row = memo->res + (size_t)memo->used * R * 2;
+	for (uint32_t r = 0; r < R; r++)
+		row[r * 2] = PAT_UNKNOWN;
+	memo->used++;
+	return row;
+}
+
+/* pat_memoexec:
+ *   Apply the regexp of a 't' or 'm' command on the given string, looking
+ *   first in the memo table if it was already done. The result is the same
+ *   than for rex_match, for 't' commands only the match or not is relevant.
+ */
+static int32_t pat_memoexec(pat_memo_t *memo, const pat_item_t *item,
+                            const char *str, uint32_t *len) {
+	int32_t *res = pat_memorow(memo, str) + item->slot * 2;
+	if (res[0] != PAT_UNKNOWN) {
+		memo->hit++;
+		*len = res[1];
+		return res[0];
 	}
-	// And general case for any position
-	int32_t pos = 0;
-	do {
-		*len = 0;
-		if (rex_matchme(re, str + pos, len))
-			return pos;
-	} while (str[pos++] != '\0');
-	// Matching failed
-	return -1;
+	memo->miss++;
+	if (item->type == 't' && item->rex->natm < 64)
+		res[0] = rex_test(item->rex, str) ? 0 : -1;
+	else
+		res[0] = rex_match(item->rex, str, len);
+	res[1] = *len;
+	return res[0];
 }
 
 /*******************************************************************************
@@ -203,6 +558,12 @@ static int32_t rex_match(const char *re, const char *str, uint32_t *len) {
  *            either "true" or "false"
  *     'm' -- match a regular expression on the token. Result is the first
  *            substring matched.
+ *
+ *   Templates usually use the same commands in many patterns, like the tokens
+ *   around the current position. A set of patterns can be compiled together
+ *   with pat_share so each distinct command is evaluated only once at each
+ *   position by pat_eval and the observations are assembled by pat_build from
+ *   these shared results.
  ******************************************************************************/
 
 /* pat_comp:
@@ -233,6 +594,10 @@ pat_t *pat_comp(char *p) {
 	while (p[pos] != '\0') {
 		pat_item_t *item = &(pat->items[nitems++]);
 		item->value = NULL;
+		item->rex   = NULL;
+		item->slot  = 0;
+		item->cmd   = 0;
+		item->len   = 0;
 		if (p[pos] == '%') {
 			// This is a command, so first parse its type and check
 			// its a valid one. Next prepare the item.
@@ -277,6 +642,7 @@ pat_t *pat_comp(char *p) {
 				item->value = wapiti_xmalloc(sizeof(char) * (len + 1));
 				memcpy(item->value, p + start, len);
 				item->value[len] = '\0';
+				item->rex = rex_comp(item->value);
 				pos++;
 			}
 			// Just check the end of the arg list and loop.
@@ -293,6 +659,7 @@ pat_t *pat_comp(char *p) {
 			const int32_t len = pos - start;
 			item->type  = 's';
 			item->caps  = false;
+			item->len   = len;
 			item->value = wapiti_xmalloc(sizeof(char) * (len + 1));
 			memcpy(item->value, p + start, len);
 			item->value[len] = '\0';
@@ -303,83 +670,241 @@ pat_t *pat_comp(char *p) {
 	return pat;
 }
 
-/* pat_exec:
- *   Execute a compiled pattern at position 'at' in the given tokens sequences
- *   in order to produce an observation string. The string is returned as a
- *   newly allocated memory block and the caller is responsible to free it when
- *   not needed anymore.
+/* pat_pos:
+ *   Return the position in a sequence of <T> tokens of the token referenced by
+ *   a command applied at position 'at'. The result may be out of the sequence.
+ */
+static int32_t pat_pos(const pat_item_t *item, uint32_t T, uint32_t at) {
+	if (!item->absolute)
+		return item->offset + (int32_t)at;
+	if (item->offset < 0)
+		return item->offset + (int32_t)T;
+	return item->offset - 1;
+}
+
+/* pat_cmd:
+ *   Apply a command item at position 'at' in the given tokens sequence and
+ *   return the resulting string with its length in <len>. The string is not
+ *   nul-terminated and casing is not yet removed from it.
  */
-char *pat_exec(const pat_t *pat, const tok_t *tok, uint32_t at) {
+static const char *pat_cmd(const pat_item_t *item, const tok_t *tok,
+                           uint32_t at, pat_memo_t *memo, uint32_t *len) {
 	static const char *bval[] = {"_x-1", "_x-2", "_x-3", "_x-4", "_x-#"};
 	static const char *eval[] = {"_x+1", "_x+2", "_x+3", "_x+4", "_x+#"};
 	const uint32_t T = tok->len;
-	// Prepare the buffer who will hold the result
-	uint32_t size = 16, pos = 0;
-	char *buffer = wapiti_xmalloc(sizeof(char) * size);
-	// And loop over the compiled items
+	// First we retrieve the token at the referenced position in the
+	// sequence. We store it in value and let the command handler do what
+	// it need with it.
+	const char *value = NULL;
+	const int32_t pos = pat_pos(item, T, at);
+	const uint32_t col = item->column;
+	if (pos < 0)
+		value = bval[min(-pos - 1, 4)];
+	else if (pos >= (int32_t)T)
+		value = eval[min( pos - (int32_t)T, 4)];
+	else if (col >= tok->cnts[pos])
+		fatal("missing tokens at %d: %d/%d, cannot apply pattern", pos, col, tok->cnts[pos]);
+	else
+		value = tok->toks[pos][col];
+	// Next, we handle the command, 'x' is very simple but 't' and 'm'
+	// require us to call the regexp matcher.
+	*len = 0;
+	if (item->type == 'x') {
+		*len = strlen(value);
+	} else if (item->type == 't') {
+		bool res;
+		if (memo != NULL)
+			res = pat_memoexec(memo, item, value, len) != -1;
+		else if (item->rex->natm < 64)
+			res = rex_test(item->rex, value);
+		else
+			res = rex_match(item->rex, value, len) != -1;
+		value = res ? "true" : "false";
+		*len = strlen(value);
+	} else if (item->type == 'm') {
+		int32_t pos;
+		if (memo != NULL)
+			pos = pat_memoexec(memo, item, value, len);
+		else
+			pos = rex_match(item->rex, value, len);
+		if (pos == -1)
+			*len = 0;
+		else
+			value += pos;
+	}
+	return value;
+}
+
+/* pat_append:
+ *   Append <len> chars of <str> at position <*pos> of the buffer <*buf> of
+ *   <*size> bytes, growing it if needed and keeping room for a final nul byte.
+ *   If <caps> is set, casing is removed from the copy.
+ */
+static void pat_append(char **buf, size_t *size, uint32_t *pos,
+                       const char *str, uint32_t len, bool caps) {
+	if (*pos + len + 1 > *size) {
+		*size = max(*size, 16);
+		while (*pos + len + 1 > *size)
+			*size = *size * 1.4;
+		*buf = wapiti_xrealloc(*buf, sizeof(char) * *size);
+	}
+	char *dst = *buf + *pos;
+	memcpy(dst, str, len);
+	if (caps)
+		for (uint32_t i = 0; i < len; i++)
+			dst[i] = tolower(dst[i]);
+	*pos += len;
+}
+
+/* pat_exec:
+ *   Execute a compiled pattern at position 'at' in the given tokens sequences
+ *   in order to produce an observation string. The string is written in the
+ *   caller owned buffer <*buf> of <*size> bytes, which is grown as needed and
+ *   can be NULL at first, so the same buffer can be reused for all the calls
+ *   without any allocation once it is large enough. The string is terminated
+ *   by a nul byte and its length is returned. If <memo> is not NULL, the
+ *   results of the regexps are memoized in it.
+ */
+uint32_t pat_exec(const pat_t *pat, const tok_t *tok, uint32_t at,
+                  pat_memo_t *memo, char **buf, size_t *size) {
+	uint32_t pos = 0;
 	for (uint32_t it = 0; it < pat->nitems; it++) {
 		const pat_item_t *item = &(pat->items[it]);
-		const char *value = NULL;
-		uint32_t len = 0;
-		// First, if needed, we retrieve the token at the referenced
-		// position in the sequence. We store it in value and let the
-		// command handler do what it need with it.
-		if (item->type != 's') {
-			int pos = item->offset;
-			if (item->absolute) {
-				if (item->offset < 0)
-					pos += T;
-				else
-					pos--;
-			} else {
-				pos += at;
-			}
-			uint32_t col = item->column;
-			if (pos < 0)
-				value = bval[min(-pos - 1, 4)];
-			else if (pos >= (int32_t)T)
-				value = eval[min( pos - (int32_t)T, 4)];
-			else if (col >= tok->cnts[pos])
-				fatal("missing tokens at %d: %d/%d, cannot apply pattern", pos, col, tok->cnts[pos]);
-			else
-				value = tok->toks[pos][col];
-		}
-		// Next, we handle the command, 's' and 'x' are very simple but
-		// 't' and 'm' require us to call the regexp matcher.
+		const char *value;
+		uint32_t len;
 		if (item->type == 's') {
 			value = item->value;
-			len = strlen(value);
-		} else if (item->type == 'x') {
-			len = strlen(value);
-		} else if (item->type == 't') {
-			if (rex_match(item->value, value, &len) == -1)
-				value = "false";
-			else
-				value = "true";
-			len = strlen(value);
-		} else if (item->type == 'm') {
-			int32_t pos = rex_match(item->value, value, &len);
-			if (pos == -1)
-				len = 0;
-			value += pos;
+			len = item->len;
+		} else {
+			value = pat_cmd(item, tok, at, memo, &len);
 		}
-		// And we add it to the buffer, growing it if needed. If the
-		// user requested it, we also remove caps from the string.
-		if (pos + len >= size - 1) {
-			while (pos + len >= size - 1)
-				size = size * 1.4;
-			buffer = wapiti_xrealloc(buffer, sizeof(char) * size);
+		pat_append(buf, size, &pos, value, len, item->caps);
+	}
+	// Terminate the result and return its length. The buffer may still
+	// be unallocated if the pattern is empty.
+	if (*size == 0)
+		*buf = wapiti_xmalloc(*size = 16);
+	(*buf)[pos] = '\0';
+	return pos;
+}
+
+/* pat_share:
+ *   Compile a set of patterns so the commands they have in common are only
+ *   evaluated once per position. Commands are identical if they have the same
+ *   type, casing, reference and regexp, they get the same index in <cmd> and
+ *   one of them is stored at this index in the returned array. The number of
+ *   distinct commands is stored in <ncmd>.
+ */
+pat_item_t **pat_share(pat_t **pats, uint32_t npats, uint32_t *ncmd) {
+	uint32_t size = 0;
+	for (uint32_t p = 0; p < npats; p++)
+		size += pats[p]->nitems;
+	pat_item_t **cmds = wapiti_xmalloc(sizeof(pat_item_t *) * max(size, 1));
+	uint32_t cnt = 0;
+	for (uint32_t p = 0; p < npats; p++) {
+		for (uint32_t i = 0; i < pats[p]->nitems; i++) {
+			pat_item_t *item = &pats[p]->items[i];
+			if (item->type == 's')
+				continue;
+			uint32_t c = 0;
+			for ( ; c < cnt; c++) {
+				const pat_item_t *o = cmds[c];
+				if (o->type     == item->type
+				 && o->caps     == item->caps
+				 && o->absolute == item->absolute
+				 && o->offset   == item->offset
+				 && o->column   == item->column
+				 && (o->value == NULL || !strcmp(o->value, item->value)))
+					break;
+			}
+			if (c == cnt)
+				cmds[cnt++] = item;
+			item->cmd = c;
 		}
-		memcpy(buffer + pos, value, len);
-		if (item->caps)
-			for (uint32_t i = pos; i < pos + len; i++)
-				buffer[i] = tolower(buffer[i]);
-		pos += len;
 	}
-	// Adjust the result and return it.
-	buffer[pos++] = '\0';
-	buffer = wapiti_xrealloc(buffer, sizeof(char) * pos);
-	return buffer;
+	*ncmd = cnt;
+	return cmds;
+}
+
+/* pat_eval:
+ *   Evaluate the <ncmd> distinct commands returned by pat_share at position
+ *   'at' in the given tokens sequence and store their results in <res>, ready
+ *   to be assembled by pat_build. The results without casing are copied in the
+ *   caller owned buffer <*buf> of <*size> bytes, grown as needed, so it must
+ *   not be modified as long as the results are used.
+ */
+void pat_eval(pat_item_t *const *cmds, uint32_t ncmd, const tok_t *tok,
+              uint32_t at, pat_memo_t *memo, pat_res_t *res,
+              char **buf, size_t *size) {
+	// The buffer may move as it grow, so for the lowered copies we first
+	// keep their offset and only fix the pointers at the end.
+	uint32_t off[max(ncmd, 1)];
+	uint32_t pos = 0;
+	for (uint32_t c = 0; c < ncmd; c++) {
+		uint32_t len;
+		const char *value = pat_cmd(cmds[c], tok, at, memo, &len);
+		res[c].str = value;
+		res[c].len = len;
+		if (cmds[c]->caps) {
+			off[c] = pos;
+			pat_append(buf, size, &pos, value, len, true);
+		}
+	}
+	for (uint32_t c = 0; c < ncmd; c++)
+		if (cmds[c]->caps)
+			res[c].str = *buf + off[c];
+}
+
+/* pat_build:
+ *   Assemble the observation string of a pattern from the results of its
+ *   commands computed by pat_eval. The string is written in the buffer <*buf>
+ *   like with pat_exec and its length is returned.
+ */
+uint32_t pat_build(const pat_t *pat, const pat_res_t *res, char **buf,
+                   size_t *size) {
+	uint32_t pos = 0;
+	for (uint32_t it = 0; it < pat->nitems; it++) {
+		const pat_item_t *item = &(pat->items[it]);
+		if (item->type == 's')
+			pat_append(buf, size, &pos, item->value, item->len, false);
+		else
+			pat_append(buf, size, &pos, res[item->cmd].str,
+			           res[item->cmd].len, false);
+	}
+	if (*size == 0)
+		*buf = wapiti_xmalloc(*size = 16);
+	(*buf)[pos] = '\0';
+	return pos;
+}
+
+/* pat_key:
+ *   Store in <key> the identifiers of the tokens used by the commands of the
+ *   pattern at position 'at', taken from <ids> which give them for each column
+ *   of each position of the sequence. As the observation only depends on these
+ *   tokens, two positions with the same key produce the same one. Tokens out
+ *   of the sequence are identified by their side and distance with values at
+ *   the top of the range, and missing ones by -1. Return the number of values
+ *   stored, which is the same for all positions.
+ */
+uint32_t pat_key(const pat_t *pat, const tok_t *tok, uint32_t *const *ids,
+                 uint32_t at, uint32_t *key) {
+	const uint32_t T = tok->len;
+	uint32_t cnt = 0;
+	for (uint32_t it = 0; it < pat->nitems; it++) {
+		const pat_item_t *item = &(pat->items[it]);
+		if (item->type == 's')
+			continue;
+		const int32_t pos = pat_pos(item, T, at);
+		if (pos < 0)
+			key[cnt++] = (uint32_t)-2 - min(-pos - 1, 4);
+		else if (pos >= (int32_t)T)
+			key[cnt++] = (uint32_t)-7 - min(pos - (int32_t)T, 4);
+		else if (item->column >= tok->cnts[pos])
+			key[cnt++] = (uint32_t)-1;
+		else
+			key[cnt++] = ids[pos][item->column];
+	}
+	return cnt;
 }
 
 /* pat_free:
@@ -388,8 +913,11 @@ char *pat_exec(const pat_t *pat, const tok_t *tok, uint32_t at) {
  *   not use this pointer again.
  */
 void pat_free(pat_t *pat) {
-	for (uint32_t it = 0; it < pat->nitems; it++)
+	for (uint32_t it = 0; it < pat->nitems; it++) {
 		free(pat->items[it].value);
+		if (pat->items[it].rex != NULL)
+			rex_free(pat->items[it].rex);
+	}
 	free(pat->src);
 	free(pat);
 }
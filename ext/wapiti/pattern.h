@@ -29,10 +29,13 @@
 #define pattern_h
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "sequence.h"
 
+typedef struct rex_s rex_t;
+typedef struct pat_ent_s pat_ent_t;
 typedef struct pat_s pat_t;
 typedef struct pat_item_s pat_item_t;
 struct pat_s {
@@ -43,15 +46,51 @@ struct pat_s {
 		char      type;
 		bool      caps;
 		char     *value;
+		rex_t    *rex;
 		bool      absolute;
 		int32_t   offset;
 		uint32_t  column;
+		uint32_t  slot;
+		uint32_t  cmd;
+		uint32_t  len;
 	} items[];
 };
 
+typedef struct pat_res_s pat_res_t;
+struct pat_res_s {
+	const char *str;   // Result of a command, not nul-terminated
+	uint32_t    len;   // Length of the result
+};
+
+typedef struct pat_memo_s pat_memo_t;
+struct pat_memo_s {
+	uint32_t   nslot;  //  R  Number of regexps slots
+	uint32_t   size;   //  S  Number of entries in the table, a power of two
+	uint32_t   used;   //  U  Number of entries in use
+	pat_ent_t *ent;    // [S] Open addressing table of tokens
+	int32_t   *res;    // [U][R][2] Start and length of the matches
+	char      *chr;    //     Copies of the memoized tokens
+	size_t     cpos;   //     Used bytes in <chr>
+	size_t     csize;  //     Size of <chr>
+	uint64_t   hit;    //     Number of lookups answered from the table
+	uint64_t   miss;   //     Number of lookups which had to run the regexp
+};
+
 pat_t *pat_comp(char *p);
-char *pat_exec(const pat_t *pat, const tok_t *tok, uint32_t at);
+uint32_t pat_exec(const pat_t *pat, const tok_t *tok, uint32_t at,
+                  pat_memo_t *memo, char **buf, size_t *size);
+pat_item_t **pat_share(pat_t **pats, uint32_t npats, uint32_t *ncmd);
+void pat_eval(pat_item_t *const *cmds, uint32_t ncmd, const tok_t *tok,
+              uint32_t at, pat_memo_t *memo, pat_res_t *res,
+              char **buf, size_t *size);
+uint32_t pat_build(const pat_t *pat, const pat_res_t *res, char **buf,
+                   size_t *size);
+uint32_t pat_key(const pat_t *pat, const tok_t *tok, uint32_t *const *ids,
+                 uint32_t at, uint32_t *key);
 void pat_free(pat_t *pat);
+uint32_t pat_slots(pat_t **pats, uint32_t npats);
+pat_memo_t *pat_memonew(uint32_t nslot);
+void pat_memofree(pat_memo_t *memo);
 
 #endif
 
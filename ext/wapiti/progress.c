@@ -92,11 +92,19 @@ void uit_setup(mdl_t *mdl) {
   }
 
 	mdl->wcnt = mdl->wpos = 0;
+
+	const uint32_t W = mdl->opt->nthread;
+	free(mdl->busy);
+	mdl->busy = wapiti_xmalloc(sizeof(double) * W);
+	for (uint32_t w = 0; w < W; w++)
+		mdl->busy[w] = 0.0;
+	mdl->wall = 0.0;
 }
 
 /* uit_cleanup:
  *   Remove the signal handler restoring the defaul behavior in case of
- *   interrupt.
+ *   interrupt. With several threads, also report how long each one was busy
+ *   or waiting for the others during the gradient and evaluation passes.
  */
 void uit_cleanup(mdl_t *mdl) {
 	unused(mdl);
@@ -105,6 +113,15 @@ void uit_cleanup(mdl_t *mdl) {
 		mdl->werr = NULL;
 	}
 
+	const uint32_t W = mdl->opt->nthread;
+	if (W > 1 && mdl->busy != NULL) {
+		for (uint32_t w = 0; w < W; w++)
+			info("thread %"PRIu32": busy %.2fs idle %.2fs", w,
+				mdl->busy[w], max(mdl->wall - mdl->busy[w], 0.0));
+	}
+	free(mdl->busy);
+	mdl->busy = NULL;
+
 	signal(SIGINT, SIG_DFL);
 }
 
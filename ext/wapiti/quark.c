@@ -32,9 +32,17 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "wapiti.h"
 #include "quark.h"
 #include "tools.h"
 
+#ifndef MAP_ANSI
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
 /******************************************************************************
  * Map object
  *
@@ -43,7 +51,8 @@
  *   version of the trie to reduce memory footprint. The special trick of using
  *   the last bit of the reference to differenciate between nodes and leafs come
  *   from Daniel J. Bernstein implementation of crit-bit tree that can be found
- *   on his web site.
+ *   on his web site. Here a leaf is just the tagged identifier of its key, the
+ *   keys themselves being kept in a separate storage described below.
  *   [1] Morrison, Donald R. ; PATRICIA-Practical Algorithm To Retrieve
  *   Information Coded in Alphanumeric, Journal of the ACM 15 (4): pp. 514--534,
  *   1968. DOI:10.1145/321479.321481
@@ -53,25 +62,432 @@
  ******************************************************************************/
 
 typedef struct node_s node_t;
-typedef struct leaf_s leaf_t;
+typedef struct blk_s  blk_t;
+typedef struct dec_s  dec_t;
+typedef struct bnd_s  bnd_t;
 struct qrk_s {
 	struct node_s {
 		node_t   *child[2];
 		uint32_t  pos;
 		uint8_t   byte;
 	} *root;
-	struct leaf_s {
+	struct blk_s {
+		blk_t    *next;
+		size_t    size;
+		size_t    used;
+		uint64_t  data[];
+	} *nodes;
+	struct {
+		char     *data;
+		uint64_t  used;
+		uint64_t  size;
+		uint64_t *offs;
+	} keys;
+	struct dec_s {
+		char     *str;
+		size_t    size;
 		uint64_t  id;
-		char      key[];
-	} **leafs;
+		uint64_t  next;
+	} *dec;
+	struct {
+		void           *addr;
+		size_t          size;
+		const bnd_t    *nodes;
+		const uint64_t *offs;
+		const char     *keys;
+		uint64_t        bytes;
+	} map;
+	uint64_t *table;
+	uint64_t  tsize;
+	struct {
+		uint32_t *pilot;
+		uint64_t *slot;
+		uint64_t  nbkt;
+	} mph;
+	const qrk_t *base;
+	uint64_t     boff;
 	bool     lock;
 	uint64_t count;
 	uint64_t size;
 };
 
-#define qrk_lf2nd(lf)  ((node_t *)((intptr_t)(lf) |  1))
-#define qrk_nd2lf(nd)  ((leaf_t *)((intptr_t)(nd) & ~1))
-#define qrk_isleaf(nd) ((intptr_t)(nd) & 1)
+#define qrk_id2nd(id)  ((node_t *)(((uintptr_t)(id) << 1) | 1))
+#define qrk_nd2id(nd)  ((uint64_t)((uintptr_t)(nd) >> 1))
+#define qrk_isleaf(nd) ((uintptr_t)(nd) & 1)
+
+/* qrk_alloc:
+ *   Allocate a block of memory of the given size from the arena <lst>. Nodes
+ *   are never freed individually, so instead of calling malloc for each of
+ *   them we carve them from large chunks which are released all at once by
+ *   qrk_free. Chunks size start small so tiny quarks like the labels one stay
+ *   cheap, and double until a maximum size. Allocations are rounded to 8 bytes
+ *   to keep the low bit of the references free for tagging leafs.
+ */
+static void *qrk_alloc(blk_t **lst, size_t size) {
+	const size_t minsz = 4096, maxsz = 1 << 20;
+	size = (size + 7) & ~(size_t)7;
+	blk_t *blk = *lst;
+	if (blk == NULL || blk->used + size > blk->size) {
+		size_t bsz = (blk == NULL) ? minsz : min(blk->size * 2, maxsz);
+		bsz = max(bsz, size);
+		blk_t *nb = wapiti_xmalloc(sizeof(blk_t) + bsz);
+		nb->next = blk;
+		nb->size = bsz;
+		nb->used = 0;
+		*lst = blk = nb;
+	}
+	void *ptr = (char *)blk->data + blk->used;
+	blk->used += size;
+	return ptr;
+}
+
+/* qrk_freeblk:
+ *   Release all the chunks of an arena.
+ */
+static void qrk_freeblk(blk_t *blk) {
+	while (blk != NULL) {
+		blk_t *nxt = blk->next;
+		free(blk);
+		blk = nxt;
+	}
+}
+
+/* qrk_keyat:
+ *   Return the byte at position <pos> of a key given as an optional prefix
+ *   byte followed by <len> bytes, <pl> being 1 if there is a prefix and 0 else.
+ *   Bytes after the end of the key are read as zero like for a nul-terminated
+ *   string.
+ */
+#define qrk_keyat(pos) ((pos) < pl ? (uint8_t)pfx                            \
+                     : (pos) < pl + len ? (uint8_t)key[(pos) - pl] : 0)
+
+/* qrk_keyeq:
+ *   Check if a stored key is equal to the prefixed key given in the same form
+ *   than for qrk_keyat.
+ */
+static bool qrk_keyeq(const char *str, char pfx, const char *key, size_t len) {
+	if (pfx != '\0' && *str++ != pfx)
+		return false;
+	return strncmp(str, key, len) == 0 && str[len] == '\0';
+}
+
+/******************************************************************************
+ * Key storage
+ *
+ *   The keys are stored in identifier order in a single buffer, front-coded by
+ *   blocks of qrk_blksz keys: the first key of a block is stored in full and
+ *   each following one as the length of the prefix it share with the previous
+ *   key, followed by the count of its remaining bytes and these bytes, the two
+ *   lengths being varints. The offset of each block is kept so any key can be
+ *   rebuilt by replaying at most a block.
+ *   Keys interned one after the other come from the same input tokens through
+ *   similar patterns, so they often share a good part of their prefix. This
+ *   avoid a copy of each key and the leaf holding it, and so cut the memory
+ *   used by large quarks almost by half.
+ *
+ *   Keys are decoded in a dec_t buffer which remember the last decoded key and
+ *   where the next one start in its block, so keys read in order cost a single
+ *   entry each. A quark has two of them, the first one used by qrk_id2str and
+ *   the second holding the last stored key. The comparisons needed by lookups
+ *   and insertions are instead done on the fly without any buffer, so searching
+ *   a quark stay a read-only operation.
+ ******************************************************************************/
+
+/* qrk_blksz:
+ *   Number of keys in a front-coded block. Larger blocks are a bit smaller but
+ *   each access to a key has to replay more entries.
+ */
+static const uint64_t qrk_blksz = 8;
+
+/* qrk_getv, qrk_putv:
+ *   Read or write a varint, 7 bits by byte starting with the lowest ones, the
+ *   high bit being set on all bytes but the last. The pointer is advanced past
+ *   the value.
+ */
+static uint64_t qrk_getv(const char **ptr) {
+	uint64_t val = 0;
+	for (int sh = 0; ; sh += 7) {
+		const uint8_t byte = *(*ptr)++;
+		val |= (uint64_t)(byte & 0x7f) << sh;
+		if (!(byte & 0x80))
+			return val;
+	}
+}
+static char *qrk_putv(char *ptr, uint64_t val) {
+	while (val >= 0x80) {
+		*ptr++ = (char)(val | 0x80);
+		val >>= 7;
+	}
+	*ptr++ = (char)val;
+	return ptr;
+}
+
+/* qrk_decode:
+ *   Rebuild the key with the given identifier in the buffer <dec> and return
+ *   it. If the buffer already hold a previous key of the same block, decoding
+ *   start from it instead of from the start of the block.
+ */
+static const char *qrk_decode(const qrk_t *qrk, dec_t *dec, uint64_t id) {
+	if (dec->id == id)
+		return dec->str;
+	uint64_t n = id - id % qrk_blksz, pos = qrk->keys.offs[id / qrk_blksz];
+	if (dec->id != none && dec->id < id && dec->id >= n)
+		n = dec->id + 1, pos = dec->next;
+	for ( ; n <= id; n++) {
+		const char *ptr = qrk->keys.data + pos;
+		const uint64_t lcp = qrk_getv(&ptr);
+		const uint64_t len = qrk_getv(&ptr);
+		if (lcp + len + 1 > dec->size) {
+			dec->size = lcp + len + 1;
+			dec->str  = wapiti_xrealloc(dec->str, dec->size);
+		}
+		memcpy(dec->str + lcp, ptr, len);
+		dec->str[lcp + len] = '\0';
+		pos = ptr + len - qrk->keys.data;
+	}
+	dec->id   = id;
+	dec->next = pos;
+	return dec->str;
+}
+
+/* qrk_lfcmp:
+ *   Compare the key with the given identifier to a key given in the same form
+ *   than for qrk_keyat without decoding it. Return the length of their common
+ *   prefix and store in <chr> the byte of the stored key following it, or zero
+ *   if it end there. The block is replayed keeping only these two values for
+ *   each key: a key sharing more bytes with the previous one than this length
+ *   differ at the same place, else it match up to its shared prefix and next
+ *   by its own bytes.
+ */
+static uint64_t qrk_lfcmp(const qrk_t *qrk, uint64_t id, char pfx,
+                          const char *key, size_t len, uint8_t *chr) {
+	const size_t pl = (pfx != '\0');
+	const char *ptr = qrk->keys.data + qrk->keys.offs[id / qrk_blksz];
+	uint64_t mat = 0;
+	uint8_t byte = 0;
+	for (uint64_t n = id % qrk_blksz + 1; n != 0; n--) {
+		const uint64_t lcp = qrk_getv(&ptr);
+		const uint64_t cnt = qrk_getv(&ptr);
+		if (mat >= lcp) {
+			// Here <str> and <key> are indexed by positions in the
+			// full keys, the prefix being handled first.
+			const char *str = ptr - lcp;
+			const uint64_t end = min(lcp + cnt, pl + len);
+			mat = lcp;
+			if (mat < pl && mat < end && str[mat] == pfx)
+				mat++;
+			if (mat >= pl)
+				while (mat < end && str[mat] == key[mat - pl])
+					mat++;
+			byte = (mat < lcp + cnt) ? (uint8_t)str[mat] : 0;
+		}
+		ptr += cnt;
+	}
+	*chr = byte;
+	return mat;
+}
+
+/* qrk_lfeq:
+ *   Check if the key with the given identifier is equal to a key given in the
+ *   same form than for qrk_keyat.
+ */
+static bool qrk_lfeq(const qrk_t *qrk, uint64_t id, char pfx, const char *key,
+                     size_t len) {
+	const size_t pl = (pfx != '\0');
+	uint8_t chr;
+	return qrk_lfcmp(qrk, id, pfx, key, len, &chr) == pl + len && chr == 0;
+}
+
+/* qrk_append:
+ *   Store a new key, given in the same form than for qrk_keyat, with the next
+ *   available identifier and return it. The last stored key is kept in the
+ *   second decoding buffer to compute the shared prefix.
+ */
+static uint64_t qrk_append(qrk_t *qrk, const char *key, size_t len, char pfx) {
+	const size_t pl = (pfx != '\0');
+	const uint64_t id = qrk->count;
+	dec_t *lst = &qrk->dec[1];
+	size_t lcp = 0;
+	if (id % qrk_blksz != 0) {
+		while (lcp < pl + len && (uint8_t)lst->str[lcp] == qrk_keyat(lcp))
+			lcp++;
+	} else {
+		const uint64_t blk = id / qrk_blksz;
+		if (blk == qrk->size) {
+			qrk->size *= 1.4;
+			const size_t size = sizeof(uint64_t) * qrk->size;
+			qrk->keys.offs = wapiti_xrealloc(qrk->keys.offs, size);
+		}
+		qrk->keys.offs[blk] = qrk->keys.used;
+	}
+	// The entry take at most 10 bytes for each varint and the remaining
+	// bytes of the key.
+	const uint64_t need = qrk->keys.used + 20 + pl + len - lcp;
+	if (need > qrk->keys.size) {
+		qrk->keys.size = max(need, qrk->keys.size * 1.4);
+		qrk->keys.data = wapiti_xrealloc(qrk->keys.data, qrk->keys.size);
+	}
+	char *ptr = qrk->keys.data + qrk->keys.used;
+	ptr = qrk_putv(ptr, lcp);
+	ptr = qrk_putv(ptr, pl + len - lcp);
+	for (size_t pos = lcp; pos < pl + len; pos++)
+		*ptr++ = qrk_keyat(pos);
+	qrk->keys.used = ptr - qrk->keys.data;
+	if (pl + len + 1 > lst->size) {
+		lst->size = pl + len + 1;
+		lst->str  = wapiti_xrealloc(lst->str, lst->size);
+	}
+	for (size_t pos = lcp; pos < pl + len; pos++)
+		lst->str[pos] = qrk_keyat(pos);
+	lst->str[pl + len] = '\0';
+	lst->id = id;
+	qrk->count++;
+	return id;
+}
+
+/* bnd_t:
+ *   A node of the trie as stored in a binary image, see the binary
+ *   serialization section below for the description of the format.
+ */
+struct bnd_s {
+	uint32_t child[2];
+	uint32_t pos;
+	uint8_t  byte;
+	uint8_t  pad[3];
+};
+
+/* qrk_le32, qrk_le64:
+ *   Convert between host and little-endian byte order. These are their own
+ *   inverse so they are used both for reading and writing.
+ */
+static bool qrk_isle(void) {
+	const uint16_t one = 1;
+	return *(const uint8_t *)&one == 1;
+}
+static uint32_t qrk_le32(uint32_t v) {
+	if (qrk_isle())
+		return v;
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+static uint64_t qrk_le64(uint64_t v) {
+	if (qrk_isle())
+		return v;
+	return ((uint64_t)qrk_le32(v) << 32) | qrk_le32(v >> 32);
+}
+
+/* qrk_chkofs:
+ *   Check that the key offsets of an image, in host order, are consistent with
+ *   the key blob so keys can be used safely.
+ */
+static void qrk_chkofs(const uint64_t *ofs, uint64_t cnt, const char *blob,
+                       uint64_t bytes) {
+	for (uint64_t n = 0; n <= cnt; n++) {
+		if (ofs[n] > bytes || (n != 0 && ofs[n] <= ofs[n - 1]))
+			fatal("invalid format");
+	}
+	if (ofs[0] != 0 || ofs[cnt] != bytes)
+		fatal("invalid format");
+	for (uint64_t n = 0; n < cnt; n++)
+		if (blob[ofs[n + 1] - 1] != '\0')
+			fatal("invalid format");
+}
+
+/* qrk_build:
+ *   Rebuild the trie of an empty quark from an image, the offsets being already
+ *   checked and in host order. The keys are stored in order, and next the nodes
+ *   are allocated in a single block replacing references by real pointers.
+ */
+static void qrk_build(qrk_t *qrk, uint64_t cnt, const bnd_t *bnd,
+                      const uint64_t *ofs, const char *blob) {
+	const uint64_t nnd = cnt - 1;
+	for (int i = 0; i < 2; i++)
+		qrk->dec[i].id = none;
+	for (uint64_t n = 0; n < cnt; n++) {
+		const size_t len = ofs[n + 1] - ofs[n] - 1;
+		if (strlen(blob + ofs[n]) != len)
+			fatal("invalid format");
+		qrk_append(qrk, blob + ofs[n], len, '\0');
+	}
+	node_t *nds = NULL;
+	if (nnd != 0)
+		nds = qrk_alloc(&qrk->nodes, sizeof(node_t) * nnd);
+	for (uint64_t n = 0; n < nnd; n++) {
+		for (int side = 0; side < 2; side++) {
+			const uint32_t ref = qrk_le32(bnd[n].child[side]);
+			const uint32_t idx = ref >> 1;
+			if (ref & 1) {
+				if (idx >= cnt)
+					fatal("invalid format");
+				nds[n].child[side] = qrk_id2nd(idx);
+			} else {
+				if (idx <= n || idx >= nnd)
+					fatal("invalid format");
+				nds[n].child[side] = &nds[idx];
+			}
+		}
+		nds[n].pos  = qrk_le32(bnd[n].pos);
+		nds[n].byte = bnd[n].byte;
+	}
+	qrk->root = (nnd != 0) ? &nds[0] : qrk_id2nd(0);
+}
+
+/* qrk_mapkey:
+ *   Return the key with the given id from the mapped image of a frozen quark.
+ */
+static const char *qrk_mapkey(const qrk_t *qrk, uint64_t id) {
+	const uint64_t beg = qrk->map.offs[id], end = qrk->map.offs[id + 1];
+	if (beg >= end || end > qrk->map.bytes || qrk->map.keys[end - 1] != '\0')
+		fatal("invalid format");
+	return qrk->map.keys + beg;
+}
+
+/* qrk_mapfind:
+ *   Search a key in the mapped image of a frozen quark, this is the same walk
+ *   than in qrk_str2id but done on the stored nodes. As nodes are numbered in
+ *   breadth-first order, a valid child always have a greater index than its
+ *   parent which ensure that the walk terminate even on a broken file.
+ */
+static uint64_t qrk_mapfind(const qrk_t *qrk, char pfx, const char *key,
+                            size_t len) {
+	const size_t pl = (pfx != '\0');
+	const uint64_t cnt = qrk->count, nnd = cnt - 1;
+	uint32_t ref = (nnd != 0) ? 0 : 1;
+	while (!(ref & 1)) {
+		const bnd_t *nd = &qrk->map.nodes[ref >> 1];
+		const uint8_t chr = qrk_keyat(nd->pos);
+		const int side = ((chr | nd->byte) + 1) >> 8;
+		const uint32_t nxt = nd->child[side];
+		if (nxt & 1) {
+			if ((nxt >> 1) >= cnt)
+				fatal("invalid format");
+		} else if ((nxt >> 1) <= (ref >> 1) || (nxt >> 1) >= nnd) {
+			fatal("invalid format");
+		}
+		ref = nxt;
+	}
+	const uint64_t id = ref >> 1;
+	if (!qrk_keyeq(qrk_mapkey(qrk, id), pfx, key, len))
+		return none;
+	return id;
+}
+
+/* qrk_unmap:
+ *   Thaw a frozen quark by copying the mapped image to memory and releasing
+ *   the mapping. This does nothing if the quark is not mapped. Be carefull
+ *   that the keys previously returned by qrk_id2str become invalid.
+ */
+void qrk_unmap(qrk_t *qrk) {
+	if (qrk->map.addr == NULL)
+		return;
+#ifndef MAP_ANSI
+	const uint64_t cnt = qrk->count;
+	qrk_chkofs(qrk->map.offs, cnt, qrk->map.keys, qrk->map.bytes);
+	qrk->count = 0;
+	qrk_build(qrk, cnt, qrk->map.nodes, qrk->map.offs, qrk->map.keys);
+	munmap(qrk->map.addr, qrk->map.size);
+#endif
+	qrk->map.addr = NULL;
+}
 
 /* qrk_new:
  *   This initialize the object for holding a new empty trie, with some pre-
@@ -79,65 +495,75 @@ struct qrk_s {
  *   not needed anymore.
  */
 qrk_t *qrk_new(void) {
-	const uint64_t size = 128;
+	const uint64_t size = 8;
 	qrk_t *qrk = wapiti_xmalloc(sizeof(qrk_t));
 	qrk->root  = NULL;
+	qrk->nodes = NULL;
+	qrk->keys.data = NULL;
+	qrk->keys.used = qrk->keys.size = 0;
+	qrk->keys.offs = wapiti_xmalloc(sizeof(uint64_t) * size);
+	qrk->dec = wapiti_xmalloc(sizeof(dec_t) * 2);
+	for (int i = 0; i < 2; i++) {
+		qrk->dec[i].str  = NULL;
+		qrk->dec[i].size = 0;
+		qrk->dec[i].id   = none;
+	}
+	qrk->map.addr = NULL;
+	qrk->table = NULL;
+	qrk->tsize = 0;
+	qrk->mph.pilot = NULL;
+	qrk->mph.slot  = NULL;
+	qrk->mph.nbkt  = 0;
+	qrk->base  = NULL;
+	qrk->boff  = 0;
 	qrk->count = 0;
 	qrk->lock  = false;
 	qrk->size  = size;
-	qrk->leafs = wapiti_xmalloc(sizeof(leaf_t *) * size);
 	return qrk;
 }
 
 /* qrk_free:
  *   Release all the memory used by a qrk_t object allocated with qrk_new. This
  *   will release all key string stored internally so all key returned by
- *   qrk_unmap become invalid and must not be used anymore.
+ *   qrk_unmap become invalid and must not be used anymore. As nodes live in an
+ *   arena, we don't have to walk the trie, just drop the chunks.
  */
 void qrk_free(qrk_t *qrk) {
-	const uint32_t stkmax = 1024;
-	if (qrk->count != 0) {
-		node_t *stk[stkmax];
-		uint32_t cnt = 0;
-		stk[cnt++] = qrk->root;
-		while (cnt != 0) {
-			node_t *nd = stk[--cnt];
-			if (qrk_isleaf(nd)) {
-				free(qrk_nd2lf(nd));
-				continue;
-			}
-			stk[cnt++] = nd->child[0];
-			stk[cnt++] = nd->child[1];
-			free(nd);
-		}
-	}
-	free(qrk->leafs);
+#ifndef MAP_ANSI
+	if (qrk->map.addr != NULL)
+		munmap(qrk->map.addr, qrk->map.size);
+#endif
+	qrk_freeblk(qrk->nodes);
+	for (int i = 0; i < 2; i++)
+		free(qrk->dec[i].str);
+	free(qrk->dec);
+	free(qrk->keys.data);
+	free(qrk->keys.offs);
+	free(qrk->table);
+	free(qrk->mph.pilot);
+	free(qrk->mph.slot);
 	free(qrk);
 }
 
-/* qrk_insert:
- *   Map a key to a uniq identifier. If the key already exist in the map, return
- *   its identifier, else allocate a new identifier and insert the new (key,id)
- *   pair inside the quark. This function is not thread safe and should not be
- *   called on the same map from different thread without locking.
+/* qrk_tinsert:
+ *   Search a key, given in the same form than for qrk_keyat, in the trie and
+ *   return its identifier. If the key is not found, it is linked in the trie
+ *   with the identifier <id> of an already stored key, or, if <id> is none, it
+ *   is stored with a new identifier unless the quark is locked.
  */
-uint64_t qrk_str2id(qrk_t *qrk, const char *key) {
-	const uint8_t *raw = (void *)key;
-	const size_t   len = strlen(key);
+static uint64_t qrk_tinsert(qrk_t *qrk, const char *key, size_t len, char pfx,
+                            uint64_t id) {
+	const size_t pl = (pfx != '\0');
 	// We first take care of the empty trie case so later we can safely
 	// assume that the trie is well formed and so there is no NULL pointers
 	// in it.
-	if (qrk->count == 0) {
-		if (qrk->lock == true)
+	if (qrk->root == NULL) {
+		if (id == none && qrk->lock == true)
 			return none;
-		const size_t size = sizeof(char) * (len + 1);
-		leaf_t *lf = wapiti_xmalloc(sizeof(leaf_t) + size);
-		memcpy(lf->key, key, size);
-		lf->id = 0;
-		qrk->root = qrk_lf2nd(lf);
-		qrk->leafs[0] = lf;
-		qrk->count = 1;
-		return 0;
+		if (id == none)
+			id = qrk_append(qrk, key, len, pfx);
+		qrk->root = qrk_id2nd(id);
+		return id;
 	}
 	// If the trie is not empty, we first go down the trie to the leaf like
 	// if we are searching for the key. When at leaf there is two case,
@@ -146,23 +572,20 @@ uint64_t qrk_str2id(qrk_t *qrk, const char *key) {
 	// differing bit between them to know where we have to add the new node.
 	const node_t *nd = qrk->root;
 	while (!qrk_isleaf(nd)) {
-		const uint8_t chr = nd->pos < len ? raw[nd->pos] : 0;
+		const uint8_t chr = qrk_keyat(nd->pos);
 		const int side = ((chr | nd->byte) + 1) >> 8;
 		nd = nd->child[side];
 	}
-	const char *bst = qrk_nd2lf(nd)->key;
-	size_t pos;
-	for (pos = 0; pos < len; pos++)
-		if (key[pos] != bst[pos])
-			break;
+	uint8_t chr;
+	const size_t pos = qrk_lfcmp(qrk, qrk_nd2id(nd), pfx, key, len, &chr);
 	uint8_t byte;
-	if (pos != len)
-		byte = key[pos] ^ bst[pos];
-	else if (bst[pos] != '\0')
-		byte = bst[pos];
+	if (pos != pl + len)
+		byte = qrk_keyat(pos) ^ chr;
+	else if (chr != '\0')
+		byte = chr;
 	else
-		return qrk_nd2lf(nd)->id;
-	if (qrk->lock == true)
+		return qrk_nd2id(nd);
+	if (id == none && qrk->lock == true)
 		return none;
 	// Now we known the two key are different and we know in which byte. It
 	// remain to build the mask for the new critical bit and build the new
@@ -170,22 +593,13 @@ uint64_t qrk_str2id(qrk_t *qrk, const char *key) {
 	while (byte & (byte - 1))
 		byte &= byte - 1;
 	byte ^= 255;
-	const uint8_t chr = bst[pos];
 	const int side = ((chr | byte) + 1) >> 8;
-	const size_t size = sizeof(char) * (len + 1);
-	node_t *nx = wapiti_xmalloc(sizeof(node_t));
-	leaf_t *lf = wapiti_xmalloc(sizeof(leaf_t) + size);
-	memcpy(lf->key, key, size);
-	lf->id   = qrk->count++;
+	node_t *nx = qrk_alloc(&qrk->nodes, sizeof(node_t));
+	if (id == none)
+		id = qrk_append(qrk, key, len, pfx);
 	nx->pos  = pos;
 	nx->byte = byte;
-	nx->child[1 - side] = qrk_lf2nd(lf);
-	if (lf->id == qrk->size) {
-		qrk->size *= 1.4;
-		const size_t size = sizeof(leaf_t *) * qrk->size;
-		qrk->leafs = wapiti_xrealloc(qrk->leafs, size);
-	}
-	qrk->leafs[lf->id] = lf;
+	nx->child[1 - side] = qrk_id2nd(id);
 	// And last thing to do: inserting the new node in the trie. We have to
 	// walk down the trie again as we have to keep the ordering of nodes. So
 	// we search for the good position to insert it.
@@ -196,26 +610,499 @@ uint64_t qrk_str2id(qrk_t *qrk, const char *key) {
 			break;
 		if (nd->pos == pos && nd->byte > byte)
 			break;
-		const uint8_t chr = nd->pos < len ? raw[nd->pos] : 0;
+		const uint8_t chr = qrk_keyat(nd->pos);
 		const int side = ((chr | nd->byte) + 1) >> 8;
 		trg = &nd->child[side];
 	}
 	nx->child[side] = *trg;
 	*trg = nx;
-	return lf->id;
+	return id;
+}
+
+/******************************************************************************
+ * Hash table backend
+ *
+ *   The trie is compact but each lookup chase a pointer per critical bit before
+ *   the final comparison. When memory is not a concern, the quark can instead
+ *   index its keys in an open-addressing hash table with linear probing, which
+ *   usually need a single cache miss to find a key. Each slot store the 32bit
+ *   hash of the key in its upper half and the identifier plus one in its lower
+ *   half, so zero mark an empty slot, most mismatch are rejected without
+ *   looking at the key, and the table can be grown without hashing the keys
+ *   again. The table is kept at most half full.
+ *
+ *   The keys are stored in the same way than for the trie, only the trie nodes
+ *   are not built, so the key storage and qrk_id2str are shared by the two
+ *   backends and a quark can be switched from one to the other at any time.
+ ******************************************************************************/
+
+/* qrk_hash:
+ *   Hash a key given in the same form than for qrk_keyat. The first byte of
+ *   the key is mixed alone and the remaining by words of 8 bytes, so a prefix
+ *   byte give the same hash than if it was part of the key string. The hash
+ *   table only use the low half of the result.
+ */
+static uint64_t qrk_hash(const char *key, size_t len, char pfx) {
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = (len + (pfx != '\0')) * mul;
+	if (pfx != '\0') {
+		h = (h ^ (uint8_t)pfx) * mul;
+	} else if (len != 0) {
+		h = (h ^ (uint8_t)key[0]) * mul;
+		key++, len--;
+	}
+	for ( ; len >= 8; key += 8, len -= 8) {
+		uint64_t w;
+		memcpy(&w, key, 8);
+		h = (h ^ w) * mul;
+		h ^= h >> 32;
+	}
+	if (len != 0) {
+		uint64_t w = 0;
+		memcpy(&w, key, len);
+		h = (h ^ w) * mul;
+	}
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* qrk_hgrow:
+ *   Resize the hash table to <size> slots, which must be a power of two, and
+ *   reinsert all the slots of the old one using their stored hash.
+ */
+static void qrk_hgrow(qrk_t *qrk, uint64_t size) {
+	uint64_t *old = qrk->table, osz = qrk->tsize;
+	uint64_t *tab = wapiti_xmalloc(sizeof(uint64_t) * size);
+	memset(tab, 0, sizeof(uint64_t) * size);
+	for (uint64_t n = 0; n < osz; n++) {
+		if (old[n] == 0)
+			continue;
+		uint64_t i = (old[n] >> 32) & (size - 1);
+		while (tab[i] != 0)
+			i = (i + 1) & (size - 1);
+		tab[i] = old[n];
+	}
+	free(old);
+	qrk->table = tab;
+	qrk->tsize = size;
+}
+
+/* qrk_hfind:
+ *   Search a key with hash <h> in the table. Return its identifier if found,
+ *   else return none and store in <slot> the free slot where it should be
+ *   inserted.
+ */
+static uint64_t qrk_hfind(const qrk_t *qrk, uint64_t h, const char *key,
+                          size_t len, char pfx, uint64_t *slot) {
+	const uint64_t msk = qrk->tsize - 1;
+	uint64_t i = h & msk;
+	for ( ; qrk->table[i] != 0; i = (i + 1) & msk) {
+		if ((qrk->table[i] >> 32) != h)
+			continue;
+		const uint64_t id = (uint32_t)qrk->table[i] - 1;
+		if (qrk_lfeq(qrk, id, pfx, key, len))
+			return id;
+	}
+	*slot = i;
+	return none;
+}
+
+/* qrk_hinsert:
+ *   Same as qrk_strn2id for a quark using the hash table backend.
+ */
+static uint64_t qrk_hinsert(qrk_t *qrk, const char *key, size_t len,
+                            char pfx) {
+	const uint64_t h = (uint32_t)qrk_hash(key, len, pfx);
+	uint64_t i;
+	const uint64_t id = qrk_hfind(qrk, h, key, len, pfx, &i);
+	if (id != none || qrk->lock == true)
+		return id;
+	if (qrk->count >= UINT32_MAX - 1)
+		fatal("too many keys for a hashed quark");
+	const uint64_t nid = qrk_append(qrk, key, len, pfx);
+	qrk->table[i] = (h << 32) | (nid + 1);
+	if (qrk->count * 2 > qrk->tsize)
+		qrk_hgrow(qrk, qrk->tsize * 2);
+	return nid;
+}
+
+/* qrk_hashed:
+ *   Switch the quark to the hash table backend if <hash> is true or to the trie
+ *   else. The keys and their identifiers are preserved, only the index is
+ *   rebuilt. A mapped quark is thawed first.
+ */
+void qrk_hashed(qrk_t *qrk, bool hash) {
+	if (hash == (qrk->table != NULL))
+		return;
+	qrk_unmap(qrk);
+	if (hash) {
+		// Drop the trie nodes and index the existing keys in a new
+		// table large enough to hold them.
+		uint64_t size = 64;
+		while (size < qrk->count * 2 + 2)
+			size *= 2;
+		qrk_freeblk(qrk->nodes);
+		qrk->nodes = NULL;
+		qrk->root  = NULL;
+		qrk->table = NULL;
+		qrk->tsize = 0;
+		qrk_hgrow(qrk, size);
+		for (uint64_t n = 0; n < qrk->count; n++) {
+			const char *key = qrk_decode(qrk, &qrk->dec[0], n);
+			const uint64_t h = (uint32_t)qrk_hash(key, strlen(key), '\0');
+			uint64_t i = h & (size - 1);
+			while (qrk->table[i] != 0)
+				i = (i + 1) & (size - 1);
+			qrk->table[i] = (h << 32) | (n + 1);
+		}
+	} else {
+		// Drop the table and link all the stored keys in a new trie
+		// with their current identifiers.
+		free(qrk->table);
+		qrk->table = NULL;
+		qrk->tsize = 0;
+		for (uint64_t n = 0; n < qrk->count; n++) {
+			const char *key = qrk_decode(qrk, &qrk->dec[0], n);
+			qrk_tinsert(qrk, key, strlen(key), '\0', n);
+		}
+	}
+}
+
+/******************************************************************************
+ * Perfect hash index
+ *
+ *   Once a model is loaded, its observations quark is locked and never change
+ *   anymore, so it can be indexed by a minimal perfect hash function built in
+ *   the spirit of the hash and displace method [1]. Keys are spread over small
+ *   buckets by their hash and for each bucket a pilot value is searched such
+ *   that mixing it with the hashes of the bucket keys send all of them to free
+ *   slots of a table with exactly one slot per key. Buckets are placed from the
+ *   largest to the smallest so the hard ones are done while the table is still
+ *   mostly empty, and buckets with a single key, which are the last ones, just
+ *   take the remaining slots directly: their pilot is the slot number tagged
+ *   with the upper bit.
+ *
+ *   Each slot hold the identifier of its key in the lower half and the upper
+ *   half of the key hash as a fingerprint. A lookup thus only read a pilot and
+ *   a slot, and the searched key is never compared to the stored one: unknown
+ *   keys are rejected by the fingerprint, except for a 2^-32 probability of
+ *   being mistaken for another key. This is why the index is only used while
+ *   the quark is locked, where unknown keys cannot be inserted by mistake; as
+ *   soon as a key is interned in an unlocked quark the index is dropped and the
+ *   trie or hash table, which is always kept, is used again.
+ *
+ *   [1] Belazzougui, Djamal ; Botelho, Fabiano C. ; Dietzfelbinger, Martin ;
+ *   Hash, Displace, and Compress, Algorithms - ESA 2009, LNCS 5757:
+ *   pp. 682--693, 2009. DOI:10.1007/978-3-642-04128-0_61
+ ******************************************************************************/
+
+/* qrk_direct:
+ *   Tag of the pilots giving directly the slot of a single key bucket.
+ */
+static const uint32_t qrk_direct = 0x80000000U;
+
+/* qrk_pslot:
+ *   Return the slot where a key of hash <h> is sent with the pilot <p> in a
+ *   table of <n> slots.
+ */
+static uint64_t qrk_pslot(uint64_t h, uint32_t p, uint64_t n) {
+	if (p & qrk_direct)
+		return p & ~qrk_direct;
+	uint64_t x = h ^ ((p + 1) * 0x9e3779b97f4a7c15ULL);
+	x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x % n;
+}
+
+/* qrk_pfind:
+ *   Search a key, given in the same form than for qrk_keyat, in the perfect
+ *   hash index. Return its identifier or none if the fingerprint don't match.
+ */
+static uint64_t qrk_pfind(const qrk_t *qrk, const char *key, size_t len,
+                          char pfx) {
+	const uint64_t h = qrk_hash(key, len, pfx);
+	const uint32_t p = qrk->mph.pilot[(uint32_t)h % qrk->mph.nbkt];
+	const uint64_t e = qrk->mph.slot[qrk_pslot(h, p, qrk->count)];
+	if ((e >> 32) != (h >> 32))
+		return none;
+	return (uint32_t)e;
+}
+
+/* qrk_perfect:
+ *   Build the perfect hash index of the quark if <perfect> is true or drop it
+ *   else. The index is only used while the quark is locked and is dropped the
+ *   first time a key is interned in the unlocked quark. If the index cannot be
+ *   built, a warning is issued and the quark is left unchanged.
+ */
+void qrk_perfect(qrk_t *qrk, bool perfect) {
+	if (perfect == (qrk->mph.slot != NULL))
+		return;
+	if (!perfect) {
+		free(qrk->mph.pilot);
+		free(qrk->mph.slot);
+		qrk->mph.pilot = NULL;
+		qrk->mph.slot  = NULL;
+		qrk->mph.nbkt  = 0;
+		return;
+	}
+	// Two keys per bucket on average keep the pilots search short.
+	const uint64_t N = qrk->count, B = N / 2 + 1;
+	if (N == 0)
+		return;
+	if (N >= qrk_direct) {
+		warning("too many keys for a perfect hash");
+		return;
+	}
+	// Hash all the keys and sort them by bucket with a counting sort,
+	// <start> giving the first key of each bucket in <keys>.
+	uint64_t *hsh   = wapiti_xmalloc(sizeof(uint64_t) * N);
+	uint32_t *keys  = wapiti_xmalloc(sizeof(uint32_t) * N);
+	uint32_t *start = wapiti_xmalloc(sizeof(uint32_t) * (B + 1));
+	memset(start, 0, sizeof(uint32_t) * (B + 1));
+	for (uint64_t n = 0; n < N; n++) {
+		const char *key = qrk->map.addr != NULL ? qrk_mapkey(qrk, n)
+		                : qrk_decode(qrk, &qrk->dec[0], n);
+		hsh[n] = qrk_hash(key, strlen(key), '\0');
+		start[(uint32_t)hsh[n] % B + 1]++;
+	}
+	uint32_t szmax = 0;
+	for (uint64_t b = 0; b < B; b++) {
+		szmax = max(szmax, start[b + 1]);
+		start[b + 1] += start[b];
+	}
+	for (uint64_t n = 0; n < N; n++)
+		keys[start[(uint32_t)hsh[n] % B]++] = n;
+	for (uint64_t b = B; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+	// Order the buckets from the largest to the smallest, again with a
+	// counting sort on their sizes.
+	uint32_t *order = wapiti_xmalloc(sizeof(uint32_t) * B);
+	uint32_t *bysz  = wapiti_xmalloc(sizeof(uint32_t) * (szmax + 2));
+	memset(bysz, 0, sizeof(uint32_t) * (szmax + 2));
+	for (uint64_t b = 0; b < B; b++)
+		bysz[szmax - (start[b + 1] - start[b]) + 1]++;
+	for (uint32_t s = 0; s <= szmax; s++)
+		bysz[s + 1] += bysz[s];
+	for (uint64_t b = 0; b < B; b++)
+		order[bysz[szmax - (start[b + 1] - start[b])]++] = b;
+	// Now place the buckets. Slots already taken are marked in <used>
+	// and the candidate slots of the current bucket kept in <pos> so they
+	// can be released if one of them collide.
+	uint32_t *pilot = wapiti_xmalloc(sizeof(uint32_t) * B);
+	uint64_t *slot  = wapiti_xmalloc(sizeof(uint64_t) * N);
+	uint64_t *pos   = wapiti_xmalloc(sizeof(uint64_t) * max(szmax, 1));
+	uint8_t  *used  = wapiti_xmalloc(sizeof(uint8_t) * N);
+	memset(used, 0, sizeof(uint8_t) * N);
+	memset(pilot, 0, sizeof(uint32_t) * B);
+	uint64_t next = 0;
+	bool ok = true;
+	for (uint64_t o = 0; o < B && ok; o++) {
+		const uint32_t b = order[o], sz = start[b + 1] - start[b];
+		const uint32_t *bk = keys + start[b];
+		if (sz == 0)
+			break;
+		uint32_t p = 0;
+		if (sz == 1) {
+			while (used[next])
+				next++;
+			p = next | qrk_direct;
+			used[next] = 1;
+		} else {
+			// A bucket holding two keys with the same hash can
+			// never be placed, so the search is bounded.
+			for ( ; ; p++) {
+				if (p == (1U << 24)) {
+					ok = false;
+					break;
+				}
+				uint32_t k = 0;
+				for ( ; k < sz; k++) {
+					pos[k] = qrk_pslot(hsh[bk[k]], p, N);
+					if (used[pos[k]])
+						break;
+					used[pos[k]] = 1;
+				}
+				if (k == sz)
+					break;
+				while (k-- > 0)
+					used[pos[k]] = 0;
+			}
+		}
+		pilot[b] = p;
+		for (uint32_t k = 0; ok && k < sz; k++) {
+			const uint64_t h = hsh[bk[k]];
+			slot[qrk_pslot(h, p, N)] = (h >> 32 << 32) | bk[k];
+		}
+	}
+	free(hsh);   free(keys); free(start);
+	free(order); free(bysz); free(pos);
+	free(used);
+	if (!ok) {
+		warning("cannot build the perfect hash, keeping the quark index");
+		free(pilot);
+		free(slot);
+		return;
+	}
+	qrk->mph.pilot = pilot;
+	qrk->mph.slot  = slot;
+	qrk->mph.nbkt  = B;
+}
+
+/* qrk_find:
+ *   Search a key, given in the same form than for qrk_keyat, without ever
+ *   inserting it whatever the lock state. This only read the quark so it can
+ *   be called from several threads at once as long as no one modify it.
+ */
+static uint64_t qrk_find(const qrk_t *qrk, const char *key, size_t len,
+                         char pfx) {
+	const size_t pl = (pfx != '\0');
+	if (qrk->count == 0)
+		return none;
+	if (qrk->mph.slot != NULL && qrk->lock == true)
+		return qrk_pfind(qrk, key, len, pfx);
+	if (qrk->map.addr != NULL)
+		return qrk_mapfind(qrk, pfx, key, len);
+	if (qrk->table != NULL) {
+		uint64_t slot;
+		const uint64_t h = (uint32_t)qrk_hash(key, len, pfx);
+		return qrk_hfind(qrk, h, key, len, pfx, &slot);
+	}
+	const node_t *nd = qrk->root;
+	while (!qrk_isleaf(nd)) {
+		const uint8_t chr = qrk_keyat(nd->pos);
+		const int side = ((chr | nd->byte) + 1) >> 8;
+		nd = nd->child[side];
+	}
+	const uint64_t id = qrk_nd2id(nd);
+	if (!qrk_lfeq(qrk, id, pfx, key, len))
+		return none;
+	return id;
+}
+
+/******************************************************************************
+ * Staging quarks
+ *
+ *   A quark is not thread safe as insertions modify the index in place. To
+ *   intern keys from several threads at once, each thread use its own staging
+ *   quark created over the shared one with qrk_stage. A stage first search the
+ *   shared quark, which is only read, and intern new keys locally with
+ *   provisional identifiers numbered after the keys present in the shared
+ *   quark when the stage was created. Once all threads are done, the stages
+ *   are merged back with qrk_merge which return the mapping from provisional
+ *   to final identifiers. As merging modify the shared quark, no stage must
+ *   be in use anymore when the first one is merged.
+ *
+ *   If the input is split in consecutive chunks and the stages are merged in
+ *   the chunks order, keys get exactly the same identifiers than if the input
+ *   was read sequentially, so identifiers stay dense and reproducible whatever
+ *   the number of threads used.
+ ******************************************************************************/
+
+/* qrk_stage:
+ *   Create a new staging quark over <base>. The stage use the same backend and
+ *   lock state than its base, and the base must not be modified as long as the
+ *   stage is in use. A stage cannot be saved.
+ */
+qrk_t *qrk_stage(const qrk_t *base) {
+	qrk_t *qrk = qrk_new();
+	qrk_hashed(qrk, base->table != NULL);
+	qrk->base = base;
+	qrk->boff = base->count;
+	qrk->lock = base->lock;
+	return qrk;
+}
+
+/* qrk_merge:
+ *   Insert all the keys interned by the stage <stg> in the quark, in the order
+ *   they were interned. Return a newly allocated array mapping the provisional
+ *   identifiers of the stage, minus the stage offset given by <off>, to their
+ *   final identifiers in the quark. If the quark is locked, unknown keys are
+ *   mapped to none.
+ */
+uint64_t *qrk_merge(qrk_t *qrk, const qrk_t *stg, uint64_t *off) {
+	const uint64_t cnt = stg->count;
+	uint64_t *map = wapiti_xmalloc(sizeof(uint64_t) * max(cnt, 1));
+	for (uint64_t n = 0; n < cnt; n++)
+		map[n] = qrk_str2id(qrk, qrk_decode(stg, &stg->dec[0], n));
+	*off = stg->boff;
+	return map;
+}
+
+/* qrk_intern:
+ *   Map a key to an identifier in this quark only, see qrk_strn2id.
+ */
+static uint64_t qrk_intern(qrk_t *qrk, const char *key, size_t len,
+                           char pfx) {
+	// The perfect hash index can only be trusted on a locked quark.
+	if (qrk->mph.slot != NULL) {
+		if (qrk->lock == true)
+			return qrk_pfind(qrk, key, len, pfx);
+		qrk_perfect(qrk, false);
+	}
+	// A frozen quark is searched in place, it has to be thawed only if a
+	// new key must be inserted.
+	if (qrk->map.addr != NULL) {
+		const uint64_t id = qrk_mapfind(qrk, pfx, key, len);
+		if (id != none || qrk->lock == true)
+			return id;
+		qrk_unmap(qrk);
+	}
+	if (qrk->table != NULL)
+		return qrk_hinsert(qrk, key, len, pfx);
+	return qrk_tinsert(qrk, key, len, pfx, none);
+}
+
+/* qrk_strn2id:
+ *   Map a key to a uniq identifier. If the key already exist in the map, return
+ *   its identifier, else allocate a new identifier and insert the new (key,id)
+ *   pair inside the quark. This function is not thread safe and should not be
+ *   called on the same map from different thread without locking.
+ *   The key is given as <len> bytes which must not contain a nul byte and does
+ *   not need to be terminated, optionally preceded by the prefix byte <pfx> if
+ *   it is not nul. This allow callers to lookup keys in place in their own
+ *   buffers without building a temporary string.
+ *   For a staging quark, keys already in the base quark get their identifier
+ *   from it and new keys are interned in the stage.
+ */
+uint64_t qrk_strn2id(qrk_t *qrk, const char *key, size_t len, char pfx) {
+	if (qrk->base == NULL)
+		return qrk_intern(qrk, key, len, pfx);
+	const uint64_t id = qrk_find(qrk->base, key, len, pfx);
+	if (id != none)
+		return id;
+	const uint64_t lid = qrk_intern(qrk, key, len, pfx);
+	if (lid == none)
+		return none;
+	return lid + qrk->boff;
+}
+
+/* qrk_str2id:
+ *   Same as qrk_strn2id for a nul-terminated key without prefix.
+ */
+uint64_t qrk_str2id(qrk_t *qrk, const char *key) {
+	return qrk_strn2id(qrk, key, strlen(key), '\0');
 }
 
 /* qrk_id2str:
  *    Retrieve the key associated to an identifier. The key is returned as a
- *    constant string that should not be modified or freed by the caller, it is
- *    a pointer to the internal copy of the key kept by the map object and
- *    remain valid only for the life time of the quark, a call to qrk_free will
- *    make this pointer invalid.
+ *    constant string that should not be modified or freed by the caller. As
+ *    keys are front-coded, it is decoded in a buffer of the quark and remain
+ *    valid only until the next call to qrk_id2str or any change of the quark.
+ *    Reading keys in identifier order is cheap as each one is decoded from the
+ *    previous one. This is not thread safe.
  */
 const char *qrk_id2str(const qrk_t *qrk, uint64_t id) {
+	if (id < qrk->boff)
+		return qrk_id2str(qrk->base, id);
+	id -= qrk->boff;
 	if (id >= qrk->count)
 		fatal("invalid identifier");
-	return qrk->leafs[id]->key;
+	if (qrk->map.addr != NULL)
+		return qrk_mapkey(qrk, id);
+	return qrk_decode(qrk, &qrk->dec[0], id);
 }
 
 /* qrk_save:
@@ -229,18 +1116,272 @@ void qrk_save(const qrk_t *qrk, FILE *file) {
 	if (qrk->count == 0)
 		return;
 	for (uint64_t n = 0; n < qrk->count; n++)
-		ns_writestr(file, qrk->leafs[n]->key);
+		ns_writestr(file, qrk_id2str(qrk, n));
 }
 
-/* qrk_load:
- *   Load a list of key from the given file and add them to the map. Each lines
- *   of the file is taken as a single key and mapped to the next available id if
- *   not already present. If all keys are single lines and the given map is
- *   initilay empty, this will load a map exactly as saved by qrk_save.
+/******************************************************************************
+ * Binary serialization
+ *
+ *   The text format above must re-insert each key in the trie when loaded,
+ *   which walk the trie twice per key and is most of the loading time for
+ *   large models. The binary section store instead an image of the trie
+ *   itself so it can be loaded with a few fread and rebuild in bulk.
+ *
+ *   The section start with a text header line:
+ *       #qrb#<count>/<bytes>/<pad>
+ *   followed by <pad> zero bytes so the binary data start at an offset
+ *   multiple of 8 in the file, and next by three arrays:
+ *     - the <count> - 1 internal nodes of the trie in breadth-first order,
+ *       each one stored on 16 bytes as two 32bit child references, the 32bit
+ *       critical position and the critical byte mask. References are
+ *       tagged like in memory: (index << 1) for a node and (id << 1) | 1 for
+ *       a leaf. The root is node 0, or leaf 0 for a single key quark ;
+ *     - <count> + 1 64bit offsets of the keys in the key blob indexed by id,
+ *       the last one being the blob size ;
+ *     - the <bytes> of the key blob: all keys with their terminating nul in
+ *       the id order.
+ *   All integers are stored in little-endian so the format remain portable.
+ *   As references are 32bit, quark with 2^31 keys or more are saved in text
+ *   form.
+ *
+ *   As the image does not contain any pointer, it can also be used in place
+ *   from a read-only mapping of the file. In this case the quark is frozen:
+ *   lookups walk directly the stored nodes and keys are returned from the
+ *   mapping, so processes mapping the same model share a single copy of it
+ *   in the page cache. Inserting a new key first thaw the quark by copying
+ *   the image to memory. The image is not checked when mapped, references
+ *   and offsets are instead checked when they are followed, so mapping stay
+ *   cheap whatever the size of the quark.
+ ******************************************************************************/
+
+/* qrk_write:
+ *   Write a raw block of data to the file failing on error.
  */
-void qrk_load(qrk_t *qrk, FILE *file) {
+static void qrk_write(FILE *file, const void *ptr, size_t size) {
+	if (size != 0 && fwrite(ptr, size, 1, file) != 1)
+		pfatal("cannot write to file");
+}
+
+/* qrk_read:
+ *   Read a raw block of data from the file failing on error or end of file.
+ */
+static void qrk_read(FILE *file, void *ptr, size_t size) {
+	if (size != 0 && fread(ptr, size, 1, file) != 1) {
+		if (ferror(file) != 0)
+			pfatal("cannot read from file");
+		fatal("invalid format");
+	}
+}
+
+/* qrk_savebin:
+ *   Save the quark to the given file in the binary form described above. The
+ *   nodes are numbered in breadth-first order so the top of the trie, visited
+ *   by every lookup, end up packed at the start of the array. The queue used
+ *   for the traversal is also the mapping from nodes index to nodes.
+ */
+void qrk_savebin(const qrk_t *qrk, FILE *file) {
+	const uint64_t cnt = qrk->count;
+	if (cnt == 0 || cnt >= ((uint64_t)1 << 31)) {
+		qrk_save(qrk, file);
+		return;
+	}
+	// The image is made of the trie nodes, so for a hashed quark we have to
+	// build a temporary trie to save it.
+	if (qrk->table != NULL) {
+		qrk_t *tmp = qrk_new();
+		for (uint64_t n = 0; n < cnt; n++)
+			qrk_str2id(tmp, qrk_decode(qrk, &qrk->dec[0], n));
+		qrk_savebin(tmp, file);
+		qrk_free(tmp);
+		return;
+	}
+	uint64_t bytes = qrk->map.bytes;
+	if (qrk->map.addr == NULL) {
+		bytes = 0;
+		for (uint64_t n = 0; n < cnt; n++)
+			bytes += strlen(qrk_decode(qrk, &qrk->dec[0], n)) + 1;
+	}
+	// Write the header with enough padding to align the binary data. If
+	// the position in the file is not known, no padding is added and the
+	// data will just not be aligned.
+	const long off = ftell(file);
+	char hdr[64];
+	const int len = snprintf(hdr, sizeof(hdr), "#qrb#%"PRIu64"/%"PRIu64"/0\n",
+		cnt, bytes);
+	const int pad = (off < 0) ? 0 : (8 - (off + len) % 8) % 8;
+	hdr[len - 2] = '0' + pad;
+	const uint8_t zero[8] = {0};
+	qrk_write(file, hdr, len);
+	qrk_write(file, zero, pad);
+	// A frozen quark already hold the image in this exact format, so it is
+	// just copied to the file.
+	if (qrk->map.addr != NULL) {
+		const char *ptr = (const char *)qrk->map.nodes;
+		const char *end = qrk->map.keys + bytes;
+		qrk_write(file, ptr, end - ptr);
+		return;
+	}
+	// Dump the internal nodes in breadth-first order. The queue is also
+	// used to number them, a node is given the next free index when its
+	// parent is written.
+	const uint32_t bsz = 4096;
+	if (cnt > 1) {
+		const node_t **que = wapiti_xmalloc(sizeof(node_t *) * (cnt - 1));
+		bnd_t *buf = wapiti_xmalloc(sizeof(bnd_t) * bsz);
+		uint64_t head = 0, tail = 0, nb = 0;
+		que[tail++] = qrk->root;
+		while (head != tail) {
+			const node_t *nd = que[head++];
+			bnd_t *bn = &buf[nb++];
+			for (int side = 0; side < 2; side++) {
+				const node_t *ch = nd->child[side];
+				uint64_t ref;
+				if (qrk_isleaf(ch)) {
+					ref = (qrk_nd2id(ch) << 1) | 1;
+				} else {
+					ref = tail << 1;
+					que[tail++] = ch;
+				}
+				bn->child[side] = qrk_le32(ref);
+			}
+			bn->pos  = qrk_le32(nd->pos);
+			bn->byte = nd->byte;
+			bn->pad[0] = bn->pad[1] = bn->pad[2] = 0;
+			if (nb == bsz || head == tail) {
+				qrk_write(file, buf, sizeof(bnd_t) * nb);
+				nb = 0;
+			}
+		}
+		free(buf);
+		free(que);
+	}
+	// Next, the offsets of the keys and the keys themselves.
+	uint64_t *ofs = wapiti_xmalloc(sizeof(uint64_t) * bsz);
+	uint64_t pos = 0, no = 0;
+	for (uint64_t n = 0; n <= cnt; n++) {
+		ofs[no++] = qrk_le64(pos);
+		if (n != cnt)
+			pos += strlen(qrk_decode(qrk, &qrk->dec[0], n)) + 1;
+		if (no == bsz || n == cnt) {
+			qrk_write(file, ofs, sizeof(uint64_t) * no);
+			no = 0;
+		}
+	}
+	free(ofs);
+	for (uint64_t n = 0; n < cnt; n++) {
+		const char *key = qrk_decode(qrk, &qrk->dec[0], n);
+		qrk_write(file, key, strlen(key) + 1);
+	}
+}
+
+/* qrk_mapbin:
+ *   Try to map the binary image at the current position of the file in an
+ *   empty quark, making it frozen. Return false if this is not possible, the
+ *   file being not a regular file or the image being unaligned or not in host
+ *   order, in which case the file is left untouched. On success, the file is
+ *   positioned at the end of the image.
+ */
+static bool qrk_mapbin(qrk_t *qrk, FILE *file, uint64_t cnt, uint64_t bytes) {
+#ifdef MAP_ANSI
+	(void)qrk; (void)file; (void)cnt; (void)bytes;
+	return false;
+#else
+	if (!qrk_isle() || qrk->count != 0 || qrk->table != NULL)
+		return false;
+	const off_t off = ftello(file);
+	struct stat st;
+	if (off < 0 || off % 8 != 0)
+		return false;
+	if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	const uint64_t nnd = cnt - 1;
+	if (bytes > (uint64_t)st.st_size)
+		fatal("invalid format");
+	const uint64_t len = sizeof(bnd_t) * nnd + sizeof(uint64_t) * (cnt + 1)
+	                   + bytes;
+	if ((uint64_t)off + len > (uint64_t)st.st_size)
+		fatal("invalid format");
+	const off_t pgsz = sysconf(_SC_PAGESIZE);
+	const off_t base = off - off % pgsz;
+	const size_t size = len + (off - base);
+	void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), base);
+	if (addr == MAP_FAILED)
+		return false;
+	if (fseeko(file, off + len, SEEK_SET) != 0) {
+		munmap(addr, size);
+		pfatal("cannot read from file");
+	}
+	const char *ptr = (const char *)addr + (off - base);
+	qrk->map.addr  = addr;
+	qrk->map.size  = size;
+	qrk->map.nodes = (const bnd_t *)ptr;
+	qrk->map.offs  = (const uint64_t *)(ptr + sizeof(bnd_t) * nnd);
+	qrk->map.keys  = (const char *)(qrk->map.offs + cnt + 1);
+	qrk->map.bytes = bytes;
+	if (qrk->map.offs[0] != 0 || qrk->map.offs[cnt] != bytes)
+		fatal("invalid format");
+	qrk->count = cnt;
+	return true;
+#endif
+}
+
+/* qrk_loadbin:
+ *   Load a binary quark section, the "#qrb#" tag is already consumed by the
+ *   caller. If <map> is true, we first try to map the image read-only. Else,
+ *   if the quark is an empty trie, it is rebuild directly from the stored
+ *   image, so no insertion is needed. Else, or if the quark is locked, we
+ *   fallback to insert the keys one by one like for the text format.
+ */
+static void qrk_loadbin(qrk_t *qrk, FILE *file, bool map) {
+	uint64_t cnt, bytes;
+	int pad;
+	if (fscanf(file, "%"SCNu64"/%"SCNu64"/%d", &cnt, &bytes, &pad) != 3)
+		fatal("invalid format");
+	if (fgetc(file) != '\n' || pad < 0 || pad > 7)
+		fatal("invalid format");
+	if (cnt == 0 || cnt >= ((uint64_t)1 << 31))
+		fatal("invalid format");
+	uint8_t zero[8];
+	qrk_read(file, zero, pad);
+	if (map && qrk_mapbin(qrk, file, cnt, bytes))
+		return;
+	const uint64_t nnd = cnt - 1;
+	bnd_t *bnd = wapiti_xmalloc(sizeof(bnd_t) * max(nnd, 1));
+	qrk_read(file, bnd, sizeof(bnd_t) * nnd);
+	uint64_t *ofs = wapiti_xmalloc(sizeof(uint64_t) * (cnt + 1));
+	qrk_read(file, ofs, sizeof(uint64_t) * (cnt + 1));
+	char *blob = wapiti_xmalloc(max(bytes, 1));
+	qrk_read(file, blob, bytes);
+	for (uint64_t n = 0; n <= cnt; n++)
+		ofs[n] = qrk_le64(ofs[n]);
+	qrk_chkofs(ofs, cnt, blob, bytes);
+	if (qrk->count != 0 || qrk->lock || qrk->table != NULL) {
+		for (uint64_t n = 0; n < cnt; n++)
+			qrk_str2id(qrk, blob + ofs[n]);
+	} else {
+		qrk_build(qrk, cnt, bnd, ofs, blob);
+	}
+	free(blob);
+	free(ofs);
+	free(bnd);
+}
+
+/* qrk_loadany:
+ *   Load a quark section of any format from the file, see qrk_load.
+ */
+static void qrk_loadany(qrk_t *qrk, FILE *file, bool map) {
 	uint64_t cnt = 0;
-	if (fscanf(file, "#qrk#%"SCNu64"\n", &cnt) != 1) {
+	char tag = 0;
+	if (fscanf(file, " #qr%c#", &tag) != 1) {
+		if (ferror(file) != 0)
+			pfatal("cannot read from file");
+		pfatal("invalid format");
+	}
+	if (tag == 'b') {
+		qrk_loadbin(qrk, file, map);
+		return;
+	}
+	if (tag != 'k' || fscanf(file, "%"SCNu64"\n", &cnt) != 1) {
 		if (ferror(file) != 0)
 			pfatal("cannot read from file");
 		pfatal("invalid format");
@@ -252,11 +1393,34 @@ void qrk_load(qrk_t *qrk, FILE *file) {
 	}
 }
 
+/* qrk_load:
+ *   Load a list of key from the given file and add them to the map. Each lines
+ *   of the file is taken as a single key and mapped to the next available id if
+ *   not already present. If all keys are single lines and the given map is
+ *   initilay empty, this will load a map exactly as saved by qrk_save.
+ *   The binary section written by qrk_savebin is detected from its header and
+ *   loaded transparently.
+ */
+void qrk_load(qrk_t *qrk, FILE *file) {
+	qrk_loadany(qrk, file, false);
+}
+
+/* qrk_map:
+ *   Same as qrk_load but if the section is binary and the quark is empty, the
+ *   image is mapped read-only instead of being copied in memory when the
+ *   platform allow it. The quark is then frozen until a new key is inserted,
+ *   and the file must not be modified while the quark is mapped, even after
+ *   being closed.
+ */
+void qrk_map(qrk_t *qrk, FILE *file) {
+	qrk_loadany(qrk, file, true);
+}
+
 /* qrk_count:
  *   Return the number of mappings stored in the quark.
  */
 uint64_t qrk_count(const qrk_t *qrk) {
-	return qrk->count;
+	return qrk->boff + qrk->count;
 }
 
 /* qrk_lock:
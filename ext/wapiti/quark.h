@@ -38,10 +38,18 @@ qrk_t *qrk_new(void);
 void qrk_free(qrk_t *qrk);
 uint64_t qrk_count(const qrk_t *qrk);
 bool qrk_lock(qrk_t *qrk, bool lock);
+void qrk_hashed(qrk_t *qrk, bool hash);
+void qrk_perfect(qrk_t *qrk, bool perfect);
+qrk_t *qrk_stage(const qrk_t *base);
+uint64_t *qrk_merge(qrk_t *qrk, const qrk_t *stg, uint64_t *off);
 const char *qrk_id2str(const qrk_t *qrk, uint64_t id);
 uint64_t qrk_str2id(qrk_t *qrk, const char *key);
+uint64_t qrk_strn2id(qrk_t *qrk, const char *key, size_t len, char pfx);
 void qrk_load(qrk_t *qrk, FILE *file);
+void qrk_map(qrk_t *qrk, FILE *file);
+void qrk_unmap(qrk_t *qrk);
 void qrk_save(const qrk_t *qrk, FILE *file);
+void qrk_savebin(const qrk_t *qrk, FILE *file);
 
 #endif
 
@@ -37,8 +37,190 @@
 #include "quark.h"
 #include "reader.h"
 #include "sequence.h"
+#include "thread.h"
 #include "tools.h"
 
+#if defined(__SSE2__) && !defined(XVM_ANSI)
+#include <emmintrin.h>
+#endif
+
+#ifndef MAP_ANSI
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+/*******************************************************************************
+ * Observations by token identifiers
+ *
+ *   An observation only depends on the pattern which built it and on the
+ *   tokens used by its commands, so instead of building its string and looking
+ *   it up in the quark, it can be found from the identifiers of these tokens.
+ *   In tokid mode, the tokens of each sequence are first interned in a quark
+ *   of their own, next each pattern give a key with the identifiers of the
+ *   tokens it use, see pat_key, which is looked up in a table mapping keys to
+ *   observations identifiers. Only the first occurrence of each key build the
+ *   observation string, all the following ones are just a few integers to
+ *   hash and compare.
+ *
+ *   The table is filled as keys are found rather than from the observations
+ *   quark at load time, as strings cannot be parsed back to the tokens they
+ *   come from. Identifiers in the table never change as observations are never
+ *   removed from the quark, only the observations rejected by a locked quark
+ *   may be added later, so the table is flushed if any was stored and the
+ *   quark has grown since. It is also flushed when it become too large, with
+ *   the tokens quark, so memory stay bounded. Code replacing or renumbering
+ *   the observations quark must drop the table with rdr_dropfid.
+ ******************************************************************************/
+
+/* rdr_fid_t:
+ *   The table of observations identifiers, with the quark of tokens and the
+ *   buffers holding their identifiers for the current sequence.
+ */
+struct rdr_fid_s {
+	qrk_t     *tok;    //     Tokens identifiers
+	uint64_t   nobs;   //     Size of the observations quark last seen
+	bool       rej;    //     Is there rejected observations in the table
+	uint32_t   size;   //  S  Number of entries, a power of two
+	uint32_t   used;   //     Number of entries in use
+	struct rdr_fent_s {
+		uint64_t hash;  // Hash of the pattern and key
+		uint64_t id;    // Observation identifier or none
+		uint32_t pat;   // Pattern index or -1 if the entry is empty
+		uint32_t key;   // Offset of the key in <keys>
+	} *ent;            // [S] Open addressing table
+	uint32_t  *keys;   //     Keys of the entries
+	size_t     kpos;   //     Used values in <keys>
+	size_t     ksize;  //     Size of <keys>
+	uint32_t  *ids;    //     Identifiers of the tokens of the sequence
+	size_t     isize;  //     Size of <ids>
+	uint32_t **row;    // [T] Identifiers by position
+	uint32_t   rsize;  //     Size of <row>
+	uint32_t  *buf;    //     Key of the current lookup
+	uint32_t   bsize;  //     Size of <buf>
+};
+
+#define RDR_FIDMIN (1 << 12)
+#define RDR_FIDMAX (1 << 22)
+
+/* rdr_fidfree:
+ *   Free a table of observations identifiers, which can be NULL.
+ */
+static void rdr_fidfree(rdr_fid_t *fid) {
+	if (fid == NULL)
+		return;
+	qrk_free(fid->tok);
+	free(fid->ent);
+	free(fid->keys);
+	free(fid->ids);
+	free(fid->row);
+	free(fid->buf);
+	free(fid);
+}
+
+/* rdr_fidclear:
+ *   Remove all the entries and tokens of the table, shrinking it back to its
+ *   initial size.
+ */
+static void rdr_fidclear(rdr_fid_t *fid) {
+	if (fid->tok != NULL)
+		qrk_free(fid->tok);
+	fid->tok  = qrk_new();
+	fid->rej  = false;
+	fid->size = RDR_FIDMIN;
+	fid->used = 0;
+	fid->ent  = wapiti_xrealloc(fid->ent, sizeof(fid->ent[0]) * fid->size);
+	for (uint32_t i = 0; i < fid->size; i++)
+		fid->ent[i].pat = (uint32_t)-1;
+	fid->kpos = 0;
+}
+
+/* rdr_fidgrow:
+ *   Double the size of the table.
+ */
+static void rdr_fidgrow(rdr_fid_t *fid) {
+	const uint32_t size = fid->size * 2;
+	struct rdr_fent_s *ent = wapiti_xmalloc(sizeof(ent[0]) * size);
+	for (uint32_t i = 0; i < size; i++)
+		ent[i].pat = (uint32_t)-1;
+	for (uint32_t i = 0; i < fid->size; i++) {
+		if (fid->ent[i].pat == (uint32_t)-1)
+			continue;
+		uint32_t n = fid->ent[i].hash & (size - 1);
+		while (ent[n].pat != (uint32_t)-1)
+			n = (n + 1) & (size - 1);
+		ent[n] = fid->ent[i];
+	}
+	free(fid->ent);
+	fid->ent  = ent;
+	fid->size = size;
+}
+
+/* rdr_dropfid:
+ *   Release the table of observations identifiers of the reader, it will be
+ *   rebuilt from scratch by the next lookup. This must be called when the
+ *   identifiers of the observations quark change.
+ */
+void rdr_dropfid(rdr_t *rdr) {
+	rdr_fidfree(rdr->ws.fid);
+	rdr->ws.fid = NULL;
+}
+
+/* rdr_tokids:
+ *   Prepare the table for a new sequence and intern its tokens, return the
+ *   identifiers of the tokens for each position as expected by pat_key.
+ */
+static uint32_t *const *rdr_tokids(rdr_t *rdr, const tok_t *tok) {
+	const uint32_t T = tok->len;
+	rdr_fid_t *fid = rdr->ws.fid;
+	if (fid == NULL) {
+		fid = rdr->ws.fid = wapiti_xmalloc(sizeof(rdr_fid_t));
+		fid->tok  = NULL;
+		fid->ent  = NULL;
+		fid->keys = NULL; fid->ksize = 0;
+		fid->ids  = NULL; fid->isize = 0;
+		fid->row  = NULL; fid->rsize = 0;
+		fid->buf  = NULL; fid->bsize = 0;
+		rdr_fidclear(fid);
+	}
+	const uint64_t nobs = qrk_count(rdr->obs);
+	if ((fid->rej && nobs != fid->nobs) || fid->size >= RDR_FIDMAX
+	 || qrk_count(fid->tok) >= RDR_FIDMAX)
+		rdr_fidclear(fid);
+	fid->nobs = nobs;
+	// Make room for the identifiers of the tokens of the sequence and
+	// for the largest possible key.
+	size_t cnt = 0;
+	for (uint32_t t = 0; t < T; t++)
+		cnt += tok->cnts[t];
+	if (cnt > fid->isize) {
+		fid->isize = cnt;
+		fid->ids = wapiti_xrealloc(fid->ids, sizeof(uint32_t) * cnt);
+	}
+	if (T > fid->rsize) {
+		fid->rsize = T;
+		fid->row = wapiti_xrealloc(fid->row, sizeof(uint32_t *) * T);
+	}
+	uint32_t nkey = 0;
+	for (uint32_t x = 0; x < rdr->npats; x++)
+		nkey = max(nkey, rdr->pats[x]->nitems);
+	if (nkey > fid->bsize) {
+		fid->bsize = nkey;
+		fid->buf = wapiti_xrealloc(fid->buf, sizeof(uint32_t) * nkey);
+	}
+	// And intern the tokens
+	uint32_t *ids = fid->ids;
+	for (uint32_t t = 0; t < T; t++) {
+		fid->row[t] = ids;
+		for (uint32_t c = 0; c < tok->cnts[t]; c++) {
+			const char *str = tok->toks[t][c];
+			*ids++ = qrk_strn2id(fid->tok, str, strlen(str), '\0');
+		}
+	}
+	return fid->row;
+}
+
 /*******************************************************************************
  * Datafile reader
  *
@@ -68,9 +250,28 @@
 rdr_t *rdr_new(bool autouni) {
 	rdr_t *rdr = wapiti_xmalloc(sizeof(rdr_t));
 	rdr->autouni = autouni;
+	rdr->binary = false;
+	rdr->mapped = false;
+	rdr->stream = false;
+	rdr->tokid = false;
 	rdr->npats = rdr->nuni = rdr->nbi = 0;
 	rdr->ntoks = 0;
+	rdr->nrex = 0;
+	rdr->ncmd = 0;
+	rdr->nbkt = 0;
 	rdr->pats = NULL;
+	rdr->cmds = NULL;
+	rdr->in.file = NULL;
+	rdr->in.addr = NULL;
+	rdr->ws.tok = NULL;   rdr->ws.tsize = 0;
+	rdr->ws.chr = NULL;   rdr->ws.csize = 0;
+	rdr->ws.ptr = NULL;   rdr->ws.psize = 0;
+	rdr->ws.obs = NULL;   rdr->ws.osize = 0;
+	rdr->ws.fid = NULL;
+	rdr->ws.memo = NULL;
+	rdr->ws.res = NULL;
+	rdr->ws.low = NULL;   rdr->ws.lsize = 0;
+	rdr->ws.seq = NULL;
 	rdr->lbl = qrk_new();
 	rdr->obs = qrk_new();
 	return rdr;
@@ -81,20 +282,48 @@ rdr_t *rdr_new(bool autouni) {
  *   any string returned by them must not be used after this call.
  */
 void rdr_free(rdr_t *rdr) {
+	rdr_unmapin(rdr);
 	for (uint32_t i = 0; i < rdr->npats; i++)
 		pat_free(rdr->pats[i]);
 	free(rdr->pats);
+	free(rdr->cmds);
+	free(rdr->ws.tok);
+	free(rdr->ws.chr);
+	free(rdr->ws.ptr);
+	free(rdr->ws.obs);
+	rdr_fidfree(rdr->ws.fid);
+	free(rdr->ws.res);
+	free(rdr->ws.low);
+	if (rdr->ws.memo != NULL)
+		pat_memofree(rdr->ws.memo);
+	if (rdr->ws.seq != NULL)
+		rdr_freeseq(rdr->ws.seq);
 	qrk_free(rdr->lbl);
 	qrk_free(rdr->obs);
 	free(rdr);
 }
 
+/* rdr_newraw:
+ *   Allocate a raw_t object for a sequence of <T> lines, the lines and their
+ *   lengths have to be filled by the caller. The object can be released with
+ *   a single call to free if the lines are not owned by it.
+ */
+raw_t *rdr_newraw(uint32_t T) {
+	raw_t *raw = wapiti_xmalloc(sizeof(raw_t) + sizeof(char *) * T
+	                          + sizeof(uint32_t) * T);
+	raw->len = T;
+	raw->mapped = false;
+	raw->lens = (uint32_t *)(raw->lines + T);
+	return raw;
+}
+
 /* rdr_freeraw:
  *   Free all memory used by a raw_t object.
  */
 void rdr_freeraw(raw_t *raw) {
-	for (uint32_t t = 0; t < raw->len; t++)
-		free(raw->lines[t]);
+	if (!raw->mapped)
+		for (uint32_t t = 0; t < raw->len; t++)
+			free(raw->lines[t]);
 	free(raw);
 }
 
@@ -110,12 +339,358 @@ void rdr_freeseq(seq_t *seq) {
  *   Free all memory used by a dat_t object.
  */
 void rdr_freedat(dat_t *dat) {
-	for (uint32_t i = 0; i < dat->nseq; i++)
-		rdr_freeseq(dat->seq[i]);
+	if (dat->map.addr != NULL) {
+#ifndef MAP_ANSI
+		munmap(dat->map.addr, dat->map.size);
+#endif
+		free(dat->map.off);
+	}
+	while (dat->blk != NULL) {
+		dat_blk_t *blk = dat->blk;
+		dat->blk = blk->next;
+		free(blk);
+	}
+	free(dat->ord);
+	free(dat->cost);
 	free(dat->seq);
 	free(dat);
 }
 
+/* rdr_blksz:
+ *   Minimum size of the blocks of the datasets arena.
+ */
+static const size_t rdr_blksz = 1 << 22;
+
+/* rdr_datalloc:
+ *   Allocate <size> bytes in the arena of the dataset. Allocations are aligned
+ *   on 8 bytes and never freed individually, the blocks are only released with
+ *   the dataset itself.
+ */
+static void *rdr_datalloc(dat_t *dat, size_t size) {
+	size = (size + 7) & ~(size_t)7;
+	dat_blk_t *blk = dat->blk;
+	if (blk == NULL || blk->size - blk->used < size) {
+		const size_t bsz = max(size, rdr_blksz);
+		blk = wapiti_xmalloc(sizeof(dat_blk_t) + bsz);
+		blk->next = dat->blk;
+		blk->size = bsz;
+		blk->used = 0;
+		dat->blk = blk;
+	}
+	void *ptr = blk->data + blk->used;
+	blk->used += size;
+	return ptr;
+}
+
+/* rdr_datseq:
+ *   Allocate in the arena of the dataset a sequence of length <T> with room
+ *   for <n> observations stored just after its positions.
+ */
+static seq_t *rdr_datseq(dat_t *dat, uint32_t T, uint64_t n) {
+	const size_t size = sizeof(seq_t) + sizeof(pos_t) * T
+	                  + sizeof(uint32_t) * n;
+	seq_t *seq = rdr_datalloc(dat, size);
+	seq->len = T;
+	seq->weight = 1;
+	seq->raw = (uint32_t *)&seq->pos[T];
+	return seq;
+}
+
+/* rdr_packdat:
+ *   Move the sequences of the dataset starting at <from> into its arena and
+ *   free the original ones. The observations lists are packed as they are
+ *   copied so the slots left unused by the reader are reclaimed.
+ */
+void rdr_packdat(dat_t *dat, uint32_t from) {
+	for (uint32_t s = from; s < dat->nseq; s++) {
+		seq_t *seq = dat->seq[s];
+		const uint32_t T = seq->len;
+		uint64_t n = 0;
+		for (uint32_t t = 0; t < T; t++)
+			n += seq->pos[t].ucnt + seq->pos[t].bcnt;
+		seq_t *cpy = rdr_datseq(dat, T, n);
+		cpy->weight = seq->weight;
+		uint32_t *raw = cpy->raw;
+		for (uint32_t t = 0; t < T; t++) {
+			const pos_t *src = &seq->pos[t];
+			pos_t *dst = &cpy->pos[t];
+			dst->lbl  = src->lbl;
+			dst->ucnt = src->ucnt;
+			dst->bcnt = src->bcnt;
+			dst->uobs = raw;
+			memcpy(raw, src->uobs, sizeof(uint32_t) * src->ucnt);
+			raw += src->ucnt;
+			dst->bobs = raw;
+			memcpy(raw, src->bobs, sizeof(uint32_t) * src->bcnt);
+			raw += src->bcnt;
+		}
+		dat->seq[s] = cpy;
+		rdr_freeseq(seq);
+	}
+}
+
+/* rdr_seqbuf:
+ *   Allocate a sequence large enough to hold any sequence of the dataset for
+ *   use with rdr_getseq. Return NULL if the dataset is in memory as no buffer
+ *   is needed in this case. The buffer must be released with free.
+ */
+seq_t *rdr_seqbuf(const dat_t *dat) {
+	if (dat->map.addr == NULL)
+		return NULL;
+	return wapiti_xmalloc(sizeof(seq_t) + sizeof(pos_t) * dat->mlen);
+}
+
+/* rdr_getseq:
+ *   Return the sequence <s> of the dataset. For datasets in memory, this is
+ *   just the stored sequence, for mapped ones, the sequence is built in <buf>
+ *   with its observations pointing in the mapping and remain valid until the
+ *   next call with the same buffer.
+ */
+const seq_t *rdr_getseq(const dat_t *dat, uint32_t s, seq_t *buf) {
+	if (dat->map.addr == NULL)
+		return dat->seq[s];
+	const uint64_t *off = dat->map.off + s * 2;
+	const uint32_t *cnt = dat->map.cnt + off[0] * 3;
+	const uint32_t *ids = dat->map.ids + off[1];
+	const uint32_t T = off[2] - off[0];
+	buf->len = T;
+	buf->weight = dat->map.wgt != NULL ? dat->map.wgt[s] : 1;
+	buf->raw = NULL;
+	for (uint32_t t = 0; t < T; t++, cnt += 3) {
+		pos_t *pos = &buf->pos[t];
+		pos->lbl  = cnt[0];
+		pos->ucnt = cnt[1];
+		pos->bcnt = cnt[2];
+		pos->uobs = (uint32_t *)ids; ids += pos->ucnt;
+		pos->bobs = (uint32_t *)ids; ids += pos->bcnt;
+	}
+	return buf;
+}
+
+/* rdr_seqhash:
+ *   Hash a sequence over its labels and observations, in the same way for all
+ *   the sequences which would be equal with rdr_seqeq.
+ */
+static uint64_t rdr_seqhash(const seq_t *seq) {
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = seq->len * mul;
+	for (uint32_t t = 0; t < seq->len; t++) {
+		const pos_t *pos = &seq->pos[t];
+		h = (h ^ pos->lbl) * mul;
+		h = (h ^ ((uint64_t)pos->ucnt << 32 | pos->bcnt)) * mul;
+		for (uint32_t n = 0; n < pos->ucnt; n++)
+			h = (h ^ pos->uobs[n]) * mul;
+		for (uint32_t n = 0; n < pos->bcnt; n++)
+			h = (h ^ pos->bobs[n]) * mul;
+		h ^= h >> 32;
+	}
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* rdr_seqeq:
+ *   Check if two sequences have the same labels and observations lists.
+ */
+static bool rdr_seqeq(const seq_t *a, const seq_t *b) {
+	if (a->len != b->len)
+		return false;
+	for (uint32_t t = 0; t < a->len; t++) {
+		const pos_t *pa = &a->pos[t], *pb = &b->pos[t];
+		if (pa->lbl != pb->lbl || pa->ucnt != pb->ucnt)
+			return false;
+		if (pa->bcnt != pb->bcnt)
+			return false;
+		if (memcmp(pa->uobs, pb->uobs, sizeof(uint32_t) * pa->ucnt))
+			return false;
+		if (memcmp(pa->bobs, pb->bobs, sizeof(uint32_t) * pa->bcnt))
+			return false;
+	}
+	return true;
+}
+
+/* rdr_dedupdat:
+ *   Merge the identical sequences of the dataset in a single one whose weight
+ *   is the number of copies, so the trainers do the work for them only once.
+ *   Sequences are identical if they have the same labels and the same lists
+ *   of observations, in the same order, at each positions. The first copy of
+ *   each sequence is kept at its place, so the order of the dataset is kept.
+ *   The merged copies are left in the arena until the dataset is released.
+ *   Mapped datasets are left as is. Return the number of sequences removed.
+ */
+uint32_t rdr_dedupdat(dat_t *dat) {
+	if (dat->map.addr != NULL || dat->nseq < 2)
+		return 0;
+	const uint32_t S = dat->nseq;
+	uint64_t size = 1;
+	while (size < (uint64_t)S * 2)
+		size *= 2;
+	uint32_t *tbl = wapiti_xmalloc(sizeof(uint32_t) * size);
+	for (uint64_t i = 0; i < size; i++)
+		tbl[i] = (uint32_t)-1;
+	uint32_t out = 0;
+	for (uint32_t s = 0; s < S; s++) {
+		seq_t *seq = dat->seq[s];
+		uint64_t i = rdr_seqhash(seq) & (size - 1);
+		while (tbl[i] != (uint32_t)-1) {
+			seq_t *cur = dat->seq[tbl[i]];
+			if (cur->weight <= UINT32_MAX - seq->weight)
+				if (rdr_seqeq(cur, seq))
+					break;
+			i = (i + 1) & (size - 1);
+		}
+		if (tbl[i] != (uint32_t)-1) {
+			dat->seq[tbl[i]]->weight += seq->weight;
+			continue;
+		}
+		tbl[i] = out;
+		dat->seq[out++] = seq;
+	}
+	free(tbl);
+	dat->nseq = out;
+	free(dat->ord);
+	free(dat->cost);
+	dat->ord  = NULL;
+	dat->cost = NULL;
+	return S - out;
+}
+
+/* rdr_appenddat:
+ *   Move all the sequences of <src> at the end of <dat> and free <src>. The
+ *   sequences are not copied, the blocks of the arena of <src> are just added
+ *   to the ones of <dat>, so appending a small dataset to a large one only
+ *   cost the growth of the sequences list. Both datasets must have been read
+ *   with the same reader and be in memory as a mapped one cannot grow.
+ */
+void rdr_appenddat(dat_t *dat, dat_t *src) {
+	if (dat->map.addr != NULL || src->map.addr != NULL)
+		fatal("cannot append to a streamed dataset");
+	if (src->nseq > UINT32_MAX - dat->nseq)
+		fatal("too many sequences in dataset");
+	const uint32_t S = dat->nseq + src->nseq;
+	dat->seq = wapiti_xrealloc(dat->seq, sizeof(seq_t *) * max(S, 1));
+	for (uint32_t s = 0; s < src->nseq; s++)
+		dat->seq[dat->nseq + s] = src->seq[s];
+	dat_blk_t **tail = &dat->blk;
+	while (*tail != NULL)
+		tail = &(*tail)->next;
+	*tail = src->blk;
+	src->blk = NULL;
+	dat->nseq = S;
+	dat->mlen = max(dat->mlen, src->mlen);
+	dat->lbl  = dat->lbl && src->lbl;
+	free(dat->ord);
+	free(dat->cost);
+	dat->ord  = NULL;
+	dat->cost = NULL;
+	rdr_freedat(src);
+}
+
+/* rdr_seqlen:
+ *   Return the length of the sequence <s> of the dataset, mapped or not.
+ */
+static uint32_t rdr_seqlen(const dat_t *dat, uint32_t s) {
+	if (dat->map.addr == NULL)
+		return dat->seq[s]->len;
+	return dat->map.off[s * 2 + 2] - dat->map.off[s * 2];
+}
+
+/* rdr_sched:
+ *   Build the schedule of the dataset for the workers: the order of the
+ *   sequences by decreasing length and the cumulated cost of the sequences in
+ *   this order, to be used with mth_spawncost. The cost of a sequence is its
+ *   length as the work done on each position, O(Y^2) for the forward-backward
+ *   and the Viterbi, is the same for all of them. The sort is a counting sort
+ *   on the lengths so sequences of equal length stay in the dataset order.
+ *   This does nothing if the schedule is already built.
+ */
+void rdr_sched(dat_t *dat) {
+	if (dat->ord != NULL)
+		return;
+	const uint32_t S = dat->nseq, L = dat->mlen;
+	uint32_t *cnt = wapiti_xmalloc(sizeof(uint32_t) * (L + 2));
+	for (uint32_t l = 0; l < L + 2; l++)
+		cnt[l] = 0;
+	for (uint32_t s = 0; s < S; s++)
+		cnt[L - rdr_seqlen(dat, s) + 1]++;
+	for (uint32_t l = 1; l < L + 2; l++)
+		cnt[l] += cnt[l - 1];
+	dat->ord  = wapiti_xmalloc(sizeof(uint32_t) * max(S, 1));
+	dat->cost = wapiti_xmalloc(sizeof(uint64_t) * (S + 1));
+	for (uint32_t s = 0; s < S; s++)
+		dat->ord[cnt[L - rdr_seqlen(dat, s)]++] = s;
+	dat->cost[0] = 0;
+	for (uint32_t s = 0; s < S; s++)
+		dat->cost[s + 1] = dat->cost[s] + rdr_seqlen(dat, dat->ord[s]);
+	free(cnt);
+}
+
+/* rdr_isspace:
+ *   Check if a character is a white space. This match the isspace function in
+ *   the "C" locale, which is what the data format use, but without going
+ *   through the locale tables: space, tab, new line, vertical tab, form feed
+ *   and carriage return.
+ */
+static inline bool rdr_isspace(char c) {
+	return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+/* rdr_spacemask:
+ *   Classify RDR_VECSZ characters at once and return a bit mask with the bits
+ *   set for the white spaces. The spaces are found by direct comparison and
+ *   the five control characters between tab and carriage return by shifting
+ *   them to the bottom of the signed range so a single signed comparison is
+ *   enough. The characters don't need to be aligned.
+ *   Wider AVX2 vectors are not used as tokens are usually shorter than 16
+ *   characters, so they only end up scanning more of the tail one by one.
+ */
+#if defined(__SSE2__) && !defined(XVM_ANSI)
+#define RDR_VECSZ 16
+static inline uint32_t rdr_spacemask(const char *str) {
+	const __m128i v = _mm_loadu_si128((const __m128i *)str);
+	const __m128i s = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	const __m128i c = _mm_add_epi8(v, _mm_set1_epi8(128 - '\t'));
+	const __m128i r = _mm_cmplt_epi8(c, _mm_set1_epi8(-128 + 5));
+	return (uint32_t)_mm_movemask_epi8(_mm_or_si128(s, r));
+}
+#endif
+
+/* rdr_skipspace, rdr_skiptoken:
+ *   Return a pointer to the first character of [<str>, <end>[ which is not a
+ *   white space, or which is one, or <end> if there is none. Full vectors are
+ *   scanned with rdr_spacemask when SSE2 is available and the remaining ones
+ *   one by one.
+ */
+static const char *rdr_skipspace(const char *str, const char *end) {
+#ifdef RDR_VECSZ
+	if (str != end && !rdr_isspace(*str))
+		return str;
+	const uint32_t all = (1U << RDR_VECSZ) - 1;
+	while (end - str >= RDR_VECSZ) {
+		const uint32_t msk = ~rdr_spacemask(str) & all;
+		if (msk != 0)
+			return str + __builtin_ctz(msk);
+		str += RDR_VECSZ;
+	}
+#endif
+	while (str != end && rdr_isspace(*str))
+		str++;
+	return str;
+}
+static const char *rdr_skiptoken(const char *str, const char *end) {
+#ifdef RDR_VECSZ
+	while (end - str >= RDR_VECSZ) {
+		const uint32_t msk = rdr_spacemask(str);
+		if (msk != 0)
+			return str + __builtin_ctz(msk);
+		str += RDR_VECSZ;
+	}
+#endif
+	while (str != end && !rdr_isspace(*str))
+		str++;
+	return str;
+}
+
 /* rdr_readline:
  *   Read an input line from <file>. The line can be of any size limited only by
  *   available memory, a buffer large enough is allocated and returned. The
@@ -160,6 +735,25 @@ char *rdr_readline(FILE *file) {
 	return wapiti_xrealloc(buffer, len + 1);
 }
 
+/* rdr_setpats:
+ *   Prepare the patterns once they are loaded: number their regexps for the
+ *   memo table and share their common commands, see pat_share. As these
+ *   change with the patterns, the workspace data built from them is dropped.
+ */
+static void rdr_setpats(rdr_t *rdr) {
+	rdr->nrex = pat_slots(rdr->pats, rdr->npats);
+	free(rdr->cmds);
+	rdr->cmds = pat_share(rdr->pats, rdr->npats, &rdr->ncmd);
+	if (rdr->ws.memo != NULL) {
+		pat_memofree(rdr->ws.memo);
+		rdr->ws.memo = NULL;
+	}
+	rdr_fidfree(rdr->ws.fid);
+	rdr->ws.fid = NULL;
+	free(rdr->ws.res);
+	rdr->ws.res = NULL;
+}
+
 /* rdr_loadpat:
  *   Load and compile patterns from given file and store them in the reader. As
  *   we compile patterns, syntax errors in them will be raised at this time.
@@ -195,32 +789,121 @@ void rdr_loadpat(rdr_t *rdr, FILE *file) {
 		rdr->pats[rdr->npats - 1] = pat;
 		rdr->ntoks = max(rdr->ntoks, pat->ntoks);
 	}
+	rdr_setpats(rdr);
+}
+
+/* rdr_mapin:
+ *   Try to map the remaining of <file> in memory so the following calls to
+ *   rdr_readraw on it return lines pointing directly in the mapping instead
+ *   of reading, allocating and copying each of them. This is only possible for
+ *   regular files, so return false and leave the file untouched for stdin or
+ *   pipes, which must be read with the usual path. The mapping is released by
+ *   rdr_unmapin and all raw sequences read from it must be freed before.
+ */
+bool rdr_mapin(rdr_t *rdr, FILE *file) {
+#ifdef MAP_ANSI
+	unused(rdr && file);
+	return false;
+#else
+	rdr_unmapin(rdr);
+	struct stat st;
+	const off_t off = ftello(file);
+	if (off < 0 || fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	if (st.st_size <= off)
+		return false;
+	// The mapping start at the logical file position, rounded down to a
+	// page boundary as required by mmap.
+	const off_t pgsz = sysconf(_SC_PAGESIZE);
+	const off_t base = off - off % pgsz;
+	const size_t size = st.st_size - base;
+	void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), base);
+	if (addr == MAP_FAILED)
+		return false;
+	madvise(addr, size, MADV_SEQUENTIAL);
+	rdr->in.file = file;
+	rdr->in.addr = addr;
+	rdr->in.size = size;
+	rdr->in.pos  = (const char *)addr + (off - base);
+	rdr->in.end  = (const char *)addr + size;
+	return true;
+#endif
+}
+
+/* rdr_unmapin:
+ *   Release the input mapping done by rdr_mapin, if any, and move the file
+ *   position after the data read from it so the file can still be read the
+ *   usual way.
+ */
+void rdr_unmapin(rdr_t *rdr) {
+#ifndef MAP_ANSI
+	if (rdr->in.addr == NULL)
+		return;
+	const off_t off = ftello(rdr->in.file);
+	const off_t pgsz = sysconf(_SC_PAGESIZE);
+	const off_t read = rdr->in.pos - (const char *)rdr->in.addr;
+	if (off >= 0)
+		fseeko(rdr->in.file, off - off % pgsz + read, SEEK_SET);
+	munmap(rdr->in.addr, rdr->in.size);
+	rdr->in.file = NULL;
+	rdr->in.addr = NULL;
+#else
+	unused(rdr);
+#endif
+}
+
+/* rdr_mapline:
+ *   Return the next line of the mapped input and store its length, without
+ *   the end of line, in <len>. On end of input, NULL is returned.
+ */
+static char *rdr_mapline(rdr_t *rdr, uint32_t *len) {
+	const char *pos = rdr->in.pos, *end = rdr->in.end;
+	if (pos == end)
+		return NULL;
+	const char *eol = memchr(pos, '\n', end - pos);
+	if (eol == NULL)
+		eol = end;
+	rdr->in.pos = (eol == end) ? end : eol + 1;
+	*len = eol - pos;
+	return (char *)pos;
 }
 
 /* rdr_readraw:
  *   Read a raw sequence from given file: a set of lines terminated by end of
  *   file or by an empty line. Return NULL if file end was reached before any
- *   sequence was read.
+ *   sequence was read. If the file was mapped with rdr_mapin, lines are taken
+ *   directly from the mapping without any copy.
  */
 raw_t *rdr_readraw(rdr_t *rdr, FILE *file) {
-	if (feof(file))
+	const bool map = rdr->in.addr != NULL && rdr->in.file == file;
+	if (!map && feof(file))
 		return NULL;
-	// Prepare the raw sequence object
+	// Prepare the lines buffers
 	uint32_t size = 32, cnt = 0;
-	raw_t *raw = wapiti_xmalloc(sizeof(raw_t) + sizeof(char *) * size);
+	char     **lines = wapiti_xmalloc(sizeof(char *) * size);
+	uint32_t  *lens  = wapiti_xmalloc(sizeof(uint32_t) * size);
 	// And read the next sequence in the file, this will skip any blank line
 	// before reading the sequence stoping at end of file or on a new blank
 	// line.
-	while (!feof(file)) {
-		char *line = rdr_readline(file);
+	while (map || !feof(file)) {
+		uint32_t len = 0;
+		char *line = NULL;
+		if (map) {
+			line = rdr_mapline(rdr, &len);
+		} else {
+			line = rdr_readline(file);
+			if (line != NULL)
+				len = strlen(line);
+		}
 		if (line == NULL)
 			break;
 		// Check for empty line marking the end of the current sequence
-		int len = strlen(line);
-		while (len != 0 && isspace(line[len - 1]))
-			len--;
-		if (len == 0) {
-			free(line);
+		uint32_t end = len;
+		while (end != 0 && rdr_isspace(line[end - 1]))
+			end--;
+		if (end == 0) {
+			if (!map)
+				free(line);
 			// Special case when no line was already read, we try
 			// again. This allow multiple blank lines beetwen
 			// sequences.
@@ -228,41 +911,68 @@ raw_t *rdr_readraw(rdr_t *rdr, FILE *file) {
 				continue;
 			break;
 		}
-		// Next, grow the buffer if needed and add the new line in it
+		// Next, grow the buffers if needed and add the new line in it
 		if (size == cnt) {
 			size *= 1.4;
-			raw = wapiti_xrealloc(raw, sizeof(raw_t)
-			                + sizeof(char *) * size);
+			lines = wapiti_xrealloc(lines, sizeof(char *) * size);
+			lens  = wapiti_xrealloc(lens, sizeof(uint32_t) * size);
 		}
-		raw->lines[cnt++] = line;
+		lines[cnt] = line;
+		lens[cnt++] = len;
 		// In autouni mode, there will be only unigram features so we
 		// can use small sequences to improve multi-theading.
 		if (rdr->autouni)
 			break;
 	}
 	// If no lines was read, we just free allocated memory and return NULL
-	// to signal the end of file to the caller. Else, we adjust the object
-	// size and return it.
-	if (cnt == 0) {
-		free(raw);
-		return NULL;
+	// to signal the end of file to the caller. Else, we build the object
+	// at the right size and return it.
+	raw_t *raw = NULL;
+	if (cnt != 0) {
+		raw = rdr_newraw(cnt);
+		raw->mapped = map;
+		memcpy(raw->lines, lines, sizeof(char *) * cnt);
+		memcpy(raw->lens, lens, sizeof(uint32_t) * cnt);
 	}
-	raw = wapiti_xrealloc(raw, sizeof(raw_t) + sizeof(char *) * cnt);
-	raw->len = cnt;
+	free(lines);
+	free(lens);
 	return raw;
 }
 
+/* rdr_hashobs:
+ *   Hash an observation of <len> bytes in one of the buckets of the reader.
+ *   This is a byte-wise FNV-1a with a final mix to spread the low bits, so the
+ *   buckets doesn't depend on the platform and models remain portable.
+ */
+static uint64_t rdr_hashobs(const rdr_t *rdr, const char *str, size_t len) {
+	const uint64_t prm = 0x100000001b3ULL;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	if (rdr->autouni)
+		h = (h ^ 'u') * prm;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (uint8_t)str[i]) * prm;
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h % rdr->nbkt;
+}
+
 /* rdr_mapobs:
- *   Map an observation to its identifier, automatically adding a 'u' prefix in
- *   'autouni' mode.
+ *   Map an observation of <len> bytes to its identifier, automatically adding
+ *   a 'u' prefix in 'autouni' mode. The string is looked up in place so it
+ *   doesn't need to be nul-terminated. With feature hashing, the identifier is
+ *   the bucket of the observation, so it is never rejected.
+ *   As sequences store the identifiers on 32 bits, reading fails if there is
+ *   more observations than this allow.
  */
-static uint64_t rdr_mapobs(rdr_t *rdr, const char *str) {
-	if (!rdr->autouni)
-		return qrk_str2id(rdr->obs, str);
-	char tmp[strlen(str) + 2];
-	tmp[0] = 'u';
-	strcpy(tmp + 1, str);
-	return qrk_str2id(rdr->obs, tmp);
+static uint64_t rdr_mapobs(rdr_t *rdr, const char *str, size_t len) {
+	uint64_t id;
+	if (rdr->nbkt != 0)
+		id = rdr_hashobs(rdr, str, len);
+	else
+		id = qrk_strn2id(rdr->obs, str, len, rdr->autouni ? 'u' : '\0');
+	if (id != none && id >= UINT32_MAX)
+		fatal("too many observations for 32 bits identifiers");
+	return id;
 }
 
 /* rdr_rawtok2seq:
@@ -289,9 +999,11 @@ static seq_t *rdr_rawtok2seq(rdr_t *rdr, const tok_t *tok) {
 		}
 	}
 	seq_t *seq = wapiti_xmalloc(sizeof(seq_t) + sizeof(pos_t) * T);
-	seq->raw = wapiti_xmalloc(sizeof(uint64_t) * size);
+	seq->raw = wapiti_xmalloc(sizeof(uint32_t) * size);
+	rdr->ws.seq = seq;
 	seq->len = T;
-	uint64_t *raw = seq->raw;
+	seq->weight = 1;
+	uint32_t *raw = seq->raw;
 	for (uint32_t t = 0; t < T; t++) {
 		seq->pos[t].lbl = (uint32_t)-1;
 		seq->pos[t].ucnt = 0;
@@ -299,7 +1011,8 @@ static seq_t *rdr_rawtok2seq(rdr_t *rdr, const tok_t *tok) {
 		for (uint32_t n = 0; n < tok->cnts[t]; n++) {
 			if (!rdr->autouni && tok->toks[t][n][0] == 'b')
 				continue;
-			uint64_t id = rdr_mapobs(rdr, tok->toks[t][n]);
+			const char *o = tok->toks[t][n];
+			uint64_t id = rdr_mapobs(rdr, o, strlen(o));
 			if (id != none) {
 				(*raw++) = id;
 				seq->pos[t].ucnt++;
@@ -312,7 +1025,8 @@ static seq_t *rdr_rawtok2seq(rdr_t *rdr, const tok_t *tok) {
 		for (uint32_t n = 0; n < tok->cnts[t]; n++) {
 			if (tok->toks[t][n][0] == 'u')
 				continue;
-			uint64_t id = rdr_mapobs(rdr, tok->toks[t][n]);
+			const char *o = tok->toks[t][n];
+			uint64_t id = rdr_mapobs(rdr, o, strlen(o));
 			if (id != none) {
 				(*raw++) = id;
 				seq->pos[t].bcnt++;
@@ -327,9 +1041,56 @@ static seq_t *rdr_rawtok2seq(rdr_t *rdr, const tok_t *tok) {
 			seq->pos[t].lbl = id;
 		}
 	}
+	rdr->ws.seq = NULL;
 	return seq;
 }
 
+/* rdr_fidobs:
+ *   Return the identifier of the observation built by pattern <x> at position
+ *   <t>, looking it up by the identifiers of its tokens. If not already known,
+ *   the observation is built and mapped as usual and added to the table.
+ */
+static uint64_t rdr_fidobs(rdr_t *rdr, const tok_t *tok, uint32_t x,
+                           uint32_t t) {
+	rdr_fid_t *fid = rdr->ws.fid;
+	uint32_t *key = fid->buf;
+	const uint32_t K = pat_key(rdr->pats[x], tok, fid->row, t, key);
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = (x + 1) * mul;
+	for (uint32_t k = 0; k < K; k++)
+		h = (h ^ key[k]) * mul;
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	uint32_t n = h & (fid->size - 1);
+	for ( ; fid->ent[n].pat != (uint32_t)-1; n = (n + 1) & (fid->size - 1)) {
+		const struct rdr_fent_s *ent = &fid->ent[n];
+		if (ent->hash == h && ent->pat == x
+		 && !memcmp(fid->keys + ent->key, key, sizeof(uint32_t) * K))
+			return ent->id;
+	}
+	// Unknown key, so build the observation and add it to the table
+	const uint32_t len = pat_exec(rdr->pats[x], tok, t, rdr->ws.memo,
+		&rdr->ws.obs, &rdr->ws.osize);
+	const uint64_t id = rdr_mapobs(rdr, rdr->ws.obs, len);
+	if ((fid->used + 1) * 4 > fid->size * 3) {
+		rdr_fidgrow(fid);
+		n = h & (fid->size - 1);
+		while (fid->ent[n].pat != (uint32_t)-1)
+			n = (n + 1) & (fid->size - 1);
+	}
+	if (fid->kpos + K > fid->ksize) {
+		fid->ksize = max(fid->ksize * 2, fid->kpos + K);
+		fid->keys = wapiti_xrealloc(fid->keys,
+			sizeof(uint32_t) * fid->ksize);
+	}
+	memcpy(fid->keys + fid->kpos, key, sizeof(uint32_t) * K);
+	fid->ent[n] = (struct rdr_fent_s){h, id, x, fid->kpos};
+	fid->kpos += K;
+	fid->used++;
+	fid->rej |= (id == none);
+	return id;
+}
+
 /* rdr_pattok2seq:
  *   Convert a tok_t to a seq_t object by applying the patterns of the reader.
  */
@@ -339,9 +1100,11 @@ static seq_t *rdr_pattok2seq(rdr_t *rdr, const tok_t *tok) {
 	// object by appling patterns. First we allocate the seq_t object. The
 	// sequence itself as well as the sub array are allocated in one time.
 	seq_t *seq = wapiti_xmalloc(sizeof(seq_t) + sizeof(pos_t) * T);
-	seq->raw = wapiti_xmalloc(sizeof(uint64_t) * (rdr->nuni + rdr->nbi) * T);
+	seq->raw = wapiti_xmalloc(sizeof(uint32_t) * (rdr->nuni + rdr->nbi) * T);
+	rdr->ws.seq = seq;
 	seq->len = T;
-	uint64_t *tmp = seq->raw;
+	seq->weight = 1;
+	uint32_t *tmp = seq->raw;
 	for (uint32_t t = 0; t < T; t++) {
 		seq->pos[t].lbl  = (uint32_t)-1;
 		seq->pos[t].uobs = tmp; tmp += rdr->nuni;
@@ -349,21 +1112,41 @@ static seq_t *rdr_pattok2seq(rdr_t *rdr, const tok_t *tok) {
 	}
 	// Next, we can build the observations list by applying the patterns on
 	// the tok_t sequence.
+	// In tokid mode, they are looked up by the identifiers of the tokens
+	// instead, and the strings are only built the first time.
+	if (rdr->ws.memo == NULL && rdr->nrex != 0)
+		rdr->ws.memo = pat_memonew(rdr->nrex);
+	// Else, the commands shared by the patterns are evaluated once at
+	// each position and the observations are assembled from them.
+	if (rdr->tokid)
+		rdr_tokids(rdr, tok);
+	else if (rdr->ws.res == NULL)
+		rdr->ws.res = wapiti_xmalloc(sizeof(pat_res_t) * max(rdr->ncmd, 1));
 	for (uint32_t t = 0; t < T; t++) {
 		pos_t *pos = &seq->pos[t];
 		pos->ucnt = 0;
 		pos->bcnt = 0;
+		if (!rdr->tokid)
+			pat_eval(rdr->cmds, rdr->ncmd, tok, t, rdr->ws.memo,
+				rdr->ws.res, &rdr->ws.low, &rdr->ws.lsize);
 		for (uint32_t x = 0; x < rdr->npats; x++) {
 			// Get the observation and map it to an identifier
-			char *obs = pat_exec(rdr->pats[x], tok, t);
-			uint64_t id = rdr_mapobs(rdr, obs);
-			if (id == none) {
-				free(obs);
-				continue;
+			uint64_t id;
+			if (rdr->tokid) {
+				id = rdr_fidobs(rdr, tok, x, t);
+			} else {
+				const uint32_t len = pat_build(rdr->pats[x],
+					rdr->ws.res, &rdr->ws.obs,
+					&rdr->ws.osize);
+				id = rdr_mapobs(rdr, rdr->ws.obs, len);
 			}
-			// If the observation is ok, add it to the lists
+			if (id == none)
+				continue;
+			// If the observation is ok, add it to the lists. Its
+			// kind is given by the first char of the pattern which
+			// is copied verbatim at the start of the observation.
 			char kind = 0;
-			switch (obs[0]) {
+			switch (rdr->pats[x]->src[0]) {
 				case 'u': kind = 1; break;
 				case 'b': kind = 2; break;
 				case '*': kind = 3; break;
@@ -372,7 +1155,6 @@ static seq_t *rdr_pattok2seq(rdr_t *rdr, const tok_t *tok) {
 				pos->uobs[pos->ucnt++] = id;
 			if (kind & 2)
 				pos->bobs[pos->bcnt++] = id;
-			free(obs);
 		}
 	}
 	// And finally, if the user specified it, populate the labels
@@ -383,45 +1165,73 @@ static seq_t *rdr_pattok2seq(rdr_t *rdr, const tok_t *tok) {
 			seq->pos[t].lbl = id;
 		}
 	}
+	rdr->ws.seq = NULL;
 	return seq;
 }
 
-/* rdr_raw2seq:
- *   Convert a raw sequence to a seq_t object suitable for training or
- *   labelling. If lbl is true, the last column is assumed to be a label and
- *   interned also.
+/* rdr_tokenize:
+ *   Split a raw sequence in tokens and return it as a tok_t object. Everything
+ *   is done in the workspace of the reader, which is grown if needed, so the
+ *   result is only valid until the next call and must not be freed. If lbl is
+ *   true, the last token of each line is moved to the labels array.
  */
-seq_t *rdr_raw2seq(rdr_t *rdr, const raw_t *raw, bool lbl) {
+static tok_t *rdr_tokenize(rdr_t *rdr, const raw_t *raw, bool lbl) {
 	const uint32_t T = raw->len;
-	// Allocate the tok_t object, the label array is allocated only if they
-	// are requested by the user.
-	tok_t *tok = wapiti_xmalloc(sizeof(tok_t) + T * sizeof(char **));
-	tok->cnts = wapiti_xmalloc(sizeof(uint32_t) * T);
-	tok->lbl = NULL;
-	if (lbl == true)
-		tok->lbl = wapiti_xmalloc(sizeof(char *) * T);
+	// First ensure the workspace is large enough. Each line is copied with
+	// its terminating nul and cannot have more than one token every two
+	// characters.
+	size_t csize = 0, psize = 0;
+	for (uint32_t t = 0; t < T; t++) {
+		csize += raw->lens[t] + 1;
+		psize += raw->lens[t] / 2 + 1;
+	}
+	if (T > rdr->ws.tsize) {
+		const size_t size = sizeof(tok_t) + T * (sizeof(char **)
+		                  + sizeof(char *) + sizeof(uint32_t));
+		free(rdr->ws.tok);
+		rdr->ws.tok = wapiti_xmalloc(size);
+		rdr->ws.tsize = T;
+	}
+	if (csize > rdr->ws.csize) {
+		free(rdr->ws.chr);
+		rdr->ws.chr = wapiti_xmalloc(csize);
+		rdr->ws.csize = csize;
+	}
+	if (psize > rdr->ws.psize) {
+		free(rdr->ws.ptr);
+		rdr->ws.ptr = wapiti_xmalloc(sizeof(char *) * psize);
+		rdr->ws.psize = psize;
+	}
+	tok_t *tok = rdr->ws.tok;
+	tok->len  = T;
+	tok->lbl  = (char **)(tok->toks + rdr->ws.tsize);
+	tok->cnts = (uint32_t *)(tok->lbl + rdr->ws.tsize);
+	if (lbl == false)
+		tok->lbl = NULL;
 	// We now take the raw sequence line by line and split them in list of
-	// tokens. To reduce memory fragmentation, the raw line is copied and
-	// his reference is kept by the first tokens, next tokens are pointer to
-	// this copy.
+	// tokens. All the lines are copied one after the other in the chars
+	// buffer and the tokens lists are consecutive slices of the pointers
+	// buffer.
+	char *line = rdr->ws.chr;
+	char **toks = rdr->ws.ptr;
 	for (uint32_t t = 0; t < T; t++) {
 		// Get a copy of the raw line skiping leading space characters
-		const char *src = raw->lines[t];
-		while (isspace(*src))
-			src++;
-		char *line = xstrdup(src);
-		// Split it in tokens
-		char *toks[strlen(line) / 2 + 1];
+		const char *src = raw->lines[t], *end = src + raw->lens[t];
+		src = rdr_skipspace(src, end);
+		memcpy(line, src, end - src);
+		line[end - src] = '\0';
+		char *next = line + (end - src) + 1;
+		// Split it in tokens, each one ending at the first white space
+		// which is replaced by a nul, or at the nul ending the line.
 		uint32_t cnt = 0;
-		while (*line != '\0') {
+		const char *lend = next - 1;
+		while (line != lend) {
 			toks[cnt++] = line;
-			while (*line != '\0' && !isspace(*line))
-				line++;
-			if (*line == '\0')
+			line = (char *)rdr_skiptoken(line, lend);
+			if (line == lend)
 				break;
 			*line++ = '\0';
-			while (*line != '\0' && isspace(*line))
-				line++;
+			line = (char *)rdr_skipspace(line, lend);
 		}
 		// If user specified that data are labelled, move the last token
 		// to the label array.
@@ -431,28 +1241,29 @@ seq_t *rdr_raw2seq(rdr_t *rdr, const raw_t *raw, bool lbl) {
 		}
 		// And put the remaining tokens in the tok_t object
 		tok->cnts[t] = cnt;
-		tok->toks[t] = wapiti_xmalloc(sizeof(char *) * cnt);
-		memcpy(tok->toks[t], toks, sizeof(char *) * cnt);
+		tok->toks[t] = toks;
+		toks += cnt + (lbl == true);
+		line = next;
 	}
-	tok->len = T;
-	// Convert the tok_t to a seq_t
-	seq_t *seq = NULL;
-	if (rdr->npats == 0)
-		seq = rdr_rawtok2seq(rdr, tok);
-	else
-		seq = rdr_pattok2seq(rdr, tok);
-	// Before returning the sequence, we have to free the tok_t
-	for (uint32_t t = 0; t < T; t++) {
-		if (tok->cnts[t] == 0)
-			continue;
-		free(tok->toks[t][0]);
-		free(tok->toks[t]);
+	return tok;
+}
+
+/* rdr_raw2seq:
+ *   Convert a raw sequence to a seq_t object suitable for training or
+ *   labelling. If lbl is true, the last column is assumed to be a label and
+ *   interned also. The sequence is tokenized in the reader workspace so no
+ *   temporary allocations are needed. The sequence under construction is kept
+ *   in the workspace so it is not lost if an error interrupt the conversion.
+ */
+seq_t *rdr_raw2seq(rdr_t *rdr, const raw_t *raw, bool lbl) {
+	if (rdr->ws.seq != NULL) {
+		rdr_freeseq(rdr->ws.seq);
+		rdr->ws.seq = NULL;
 	}
-	free(tok->cnts);
-	if (lbl == true)
-		free(tok->lbl);
-	free(tok);
-	return seq;
+	tok_t *tok = rdr_tokenize(rdr, raw, lbl);
+	if (rdr->npats == 0)
+		return rdr_rawtok2seq(rdr, tok);
+	return rdr_pattok2seq(rdr, tok);
 }
 
 /* rdr_readseq:
@@ -471,12 +1282,128 @@ seq_t *rdr_readseq(rdr_t *rdr, FILE *file, bool lbl) {
 	return seq;
 }
 
+/* rdr_par_t:
+ *   State shared by the workers of rdr_raw2seqs. The <n> raw sequences are
+ *   split in chunks of <csize> consecutive sequences, each one converted with
+ *   its own fork of the reader. The first error raised by a worker is kept in
+ *   <msg> and the remaining chunks are skipped.
+ */
+typedef struct rdr_par_s rdr_par_t;
+struct rdr_par_s {
+	rdr_t          **stg;      // [C] Forks of the reader, one per chunk
+	raw_t *const    *raw;      // [N] Raw sequences to convert
+	seq_t          **seq;      // [N] Resulting sequences
+	uint32_t         n;        //  N  Number of sequences
+	uint32_t         csize;    //     Number of sequences per chunk
+	bool             lbl;      //     Are the sequences labelled
+	volatile bool    fail;     //     Has a worker failed
+	char             msg[512]; //     Message of the first error
+	pthread_mutex_t  lock;     //     Lock for the error report
+};
+
+/* rdr_worker:
+ *   Convert the chunks of raw sequences given by the job scheduler, each one
+ *   with its own fork. Errors cannot be raised from here, so they are trapped
+ *   and reported in <par> and the worker stops.
+ */
+static void rdr_worker(job_t *job, uint32_t id, uint32_t cnt, rdr_par_t *par) {
+	unused(id && cnt);
+	trap_t trap;
+	wrktrap(&trap);
+	if (setjmp(trap.env) == 0) {
+		uint32_t count, pos;
+		while (!par->fail && mth_getjob(job, &count, &pos)) {
+			for (uint32_t c = pos; c < pos + count; c++) {
+				const uint32_t beg = c * par->csize;
+				const uint32_t end = min(beg + par->csize, par->n);
+				for (uint32_t s = beg; s < end; s++)
+					par->seq[s] = rdr_raw2seq(par->stg[c],
+					                   par->raw[s], par->lbl);
+			}
+		}
+	} else {
+		pthread_mutex_lock(&par->lock);
+		if (!par->fail)
+			strcpy(par->msg, trap.msg);
+		par->fail = true;
+		pthread_mutex_unlock(&par->lock);
+	}
+	wrktrap(NULL);
+}
+
+/* rdr_raw2seqs:
+ *   Convert <n> raw sequences to seq_t objects like rdr_raw2seq but using <W>
+ *   threads. The sequences are split in chunks converted in parallel, each one
+ *   with a fork of the reader, and the forks are joined back in the chunks
+ *   order so labels and observations get exactly the same identifiers than if
+ *   the sequences were converted one after the other.
+ *   If a worker fail, everything converted is released, the error message is
+ *   left in the reader workspace and false is returned so the caller can free
+ *   its own data before raising it.
+ */
+bool rdr_raw2seqs(rdr_t *rdr, raw_t *const *raw, seq_t **seq, uint32_t n,
+                  bool lbl, uint32_t W) {
+	if (W <= 1 || n <= 1) {
+		for (uint32_t s = 0; s < n; s++)
+			seq[s] = rdr_raw2seq(rdr, raw[s], lbl);
+		return true;
+	}
+	// Use a few chunks per thread so the workers stay busy even if some
+	// chunks are slower than others.
+	const uint32_t C = min(W * 4, n);
+	rdr_par_t par = {
+		.raw = raw, .seq = seq, .n = n,
+		.csize = (n + C - 1) / C, .lbl = lbl,
+		.fail = false,
+	};
+	if (pthread_mutex_init(&par.lock, NULL) != 0)
+		fatal("failed to create mutex");
+	par.stg = wapiti_xmalloc(sizeof(rdr_t *) * C);
+	for (uint32_t c = 0; c < C; c++)
+		par.stg[c] = rdr_fork(rdr);
+	for (uint32_t s = 0; s < n; s++)
+		seq[s] = NULL;
+	rdr_par_t *ud[W];
+	for (uint32_t w = 0; w < W; w++)
+		ud[w] = &par;
+	mth_spawn((func_t *)rdr_worker, W, (void **)ud, C, 1);
+	pthread_mutex_destroy(&par.lock);
+	// If a worker failed, drop all the work done, including the sequences
+	// left unfinished in the forks, and report its error to the caller.
+	if (par.fail) {
+		for (uint32_t c = 0; c < C; c++)
+			rdr_dropfork(par.stg[c]);
+		for (uint32_t s = 0; s < n; s++)
+			if (seq[s] != NULL)
+				rdr_freeseq(seq[s]);
+		free(par.stg);
+		strcpy(rdr->ws.err, par.msg);
+		return false;
+	}
+	for (uint32_t c = 0; c < C; c++) {
+		const uint32_t beg = min(c * par.csize, n);
+		const uint32_t end = min(beg + par.csize, n);
+		rdr_join(rdr, par.stg[c], seq + beg, end - beg);
+	}
+	free(par.stg);
+	return true;
+}
+
 /* rdr_readdat:
  *   Read a full dataset at once and return it as a dat_t object. This function
  *   take and interpret his parameters like the single sequence reading
- *   function.
+ *   function. Raw sequences are read by batches of a thousand per thread and
+ *   converted with rdr_raw2seqs using <W> threads. Dataset caches saved by
+ *   rdr_savedat are recognized and loaded directly.
  */
-dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl) {
+dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl, uint32_t W) {
+	if (rdr_iswbin(file)) {
+		dat_t *dat = rdr_loaddat(rdr, file);
+		if (dat != NULL && lbl && !dat->lbl)
+			fatal("dataset cache is not labelled");
+		return dat;
+	}
+	const uint32_t batch = 1000 * max(W, 1);
 	// Prepare dataset
 	uint32_t size = 1000;
 	dat_t *dat = wapiti_xmalloc(sizeof(dat_t));
@@ -484,27 +1411,50 @@ dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl) {
 	dat->mlen = 0;
 	dat->lbl = lbl;
 	dat->seq = wapiti_xmalloc(sizeof(seq_t *) * size);
+	dat->blk = NULL;
+	dat->ord = NULL;
+	dat->cost = NULL;
+	dat->map.addr = NULL;
+	raw_t **raw = wapiti_xmalloc(sizeof(raw_t *) * batch);
+	rdr_mapin(rdr, file);
 	// Load sequences
 	while (!feof(file)) {
-		// Read the next sequence
-		seq_t *seq = rdr_readseq(rdr, file, lbl);
-		if (seq == NULL)
+		// Read the next batch of raw sequences
+		uint32_t cnt = 0;
+		while (cnt < batch && (raw[cnt] = rdr_readraw(rdr, file)) != NULL)
+			cnt++;
+		if (cnt == 0)
 			break;
 		// Grow the buffer if needed
-		if (dat->nseq == size) {
+		while (dat->nseq + cnt > size) {
 			size *= 1.4;
 			dat->seq = wapiti_xrealloc(dat->seq, sizeof(seq_t *) * size);
 		}
-		// And store the sequence
-		dat->seq[dat->nseq++] = seq;
-		dat->mlen = max(dat->mlen, seq->len);
-		if (dat->nseq % 1000 == 0)
-			info("%7"PRIu32" sequences loaded\n", dat->nseq);
+		// And convert them directly in the dataset, next move them
+		// in its arena so they are stored in load order.
+		seq_t **seq = dat->seq + dat->nseq;
+		if (!rdr_raw2seqs(rdr, raw, seq, cnt, lbl, W)) {
+			for (uint32_t s = 0; s < cnt; s++)
+				rdr_freeraw(raw[s]);
+			free(raw);
+			rdr_unmapin(rdr);
+			rdr_freedat(dat);
+			fatal("%s", rdr->ws.err);
+		}
+		for (uint32_t s = 0; s < cnt; s++) {
+			dat->mlen = max(dat->mlen, dat->seq[dat->nseq + s]->len);
+			rdr_freeraw(raw[s]);
+		}
+		dat->nseq += cnt;
+		rdr_packdat(dat, dat->nseq - cnt);
+		info("%7"PRIu32" sequences loaded\n", dat->nseq);
 	}
+	free(raw);
+	rdr_unmapin(rdr);
+	rdr_memoinfo(rdr);
 	// If no sequence readed, cleanup and repport
 	if (dat->nseq == 0) {
-		free(dat->seq);
-		free(dat);
+		rdr_freedat(dat);
 		return NULL;
 	}
 	// Adjust the dataset size and return
@@ -513,27 +1463,141 @@ dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl) {
 	return dat;
 }
 
+/* rdr_fork:
+ *   Create a staging reader over the given one so sequences can be converted
+ *   with rdr_raw2seq from several threads at once, each one using its own
+ *   fork. The fork share the patterns of its parent and intern new labels and
+ *   observations in staging quarks, so the parent must not be used until all
+ *   its forks are joined back, and all the forks must be done before the
+ *   first one is joined. Forks must be released with rdr_join and not with
+ *   rdr_free.
+ */
+rdr_t *rdr_fork(const rdr_t *rdr) {
+	rdr_t *stg = wapiti_xmalloc(sizeof(rdr_t));
+	*stg = *rdr;
+	stg->lbl = qrk_stage(rdr->lbl);
+	stg->obs = qrk_stage(rdr->obs);
+	stg->ws.tok = NULL;   stg->ws.tsize = 0;
+	stg->ws.chr = NULL;   stg->ws.csize = 0;
+	stg->ws.ptr = NULL;   stg->ws.psize = 0;
+	stg->ws.obs = NULL;   stg->ws.osize = 0;
+	stg->ws.fid = NULL;
+	stg->ws.memo = NULL;
+	stg->ws.res = NULL;
+	stg->ws.low = NULL;   stg->ws.lsize = 0;
+	stg->ws.seq = NULL;
+	return stg;
+}
+
+/* rdr_dropfork:
+ *   Release a fork without merging anything back in its parent.
+ */
+void rdr_dropfork(rdr_t *stg) {
+	qrk_free(stg->lbl);
+	qrk_free(stg->obs);
+	free(stg->ws.tok);
+	free(stg->ws.chr);
+	free(stg->ws.ptr);
+	free(stg->ws.obs);
+	rdr_fidfree(stg->ws.fid);
+	free(stg->ws.res);
+	free(stg->ws.low);
+	if (stg->ws.memo != NULL)
+		pat_memofree(stg->ws.memo);
+	if (stg->ws.seq != NULL)
+		rdr_freeseq(stg->ws.seq);
+	free(stg);
+}
+
+/* rdr_remap:
+ *   Replace the provisional identifiers of a staging quark by their final value
+ *   using the mapping returned by qrk_merge.
+ */
+static void rdr_remap(uint32_t *ids, uint32_t cnt, const uint64_t *map,
+                      uint64_t off) {
+	for (uint32_t n = 0; n < cnt; n++)
+		if (ids[n] >= off)
+			ids[n] = map[ids[n] - off];
+}
+
+/* rdr_join:
+ *   Merge back the labels and observations interned by a fork in its parent
+ *   reader and fix the identifiers in the <nseq> sequences it has produced,
+ *   next release the fork. If forks are used on consecutive chunks of a
+ *   dataset and joined in the chunks order, the identifiers are the same than
+ *   when the dataset is read sequentially. Hashed observations are final as
+ *   soon as they are computed and are left untouched.
+ */
+void rdr_join(rdr_t *rdr, rdr_t *stg, seq_t **seq, uint32_t nseq) {
+	uint64_t loff, ooff;
+	uint64_t *lmap = qrk_merge(rdr->lbl, stg->lbl, &loff);
+	uint64_t *omap = qrk_merge(rdr->obs, stg->obs, &ooff);
+	for (uint32_t s = 0; s < nseq; s++) {
+		for (uint32_t t = 0; t < seq[s]->len; t++) {
+			pos_t *pos = &seq[s]->pos[t];
+			if (pos->lbl != (uint32_t)-1 && pos->lbl >= loff)
+				pos->lbl = lmap[pos->lbl - loff];
+			if (rdr->nbkt != 0)
+				continue;
+			rdr_remap(pos->uobs, pos->ucnt, omap, ooff);
+			rdr_remap(pos->bobs, pos->bcnt, omap, ooff);
+		}
+	}
+	free(lmap);
+	free(omap);
+	if (stg->ws.memo != NULL) {
+		if (rdr->ws.memo == NULL)
+			rdr->ws.memo = pat_memonew(rdr->nrex);
+		rdr->ws.memo->hit  += stg->ws.memo->hit;
+		rdr->ws.memo->miss += stg->ws.memo->miss;
+	}
+	rdr_dropfork(stg);
+}
+
+/* rdr_memoinfo:
+ *   Report the hit rate of the memoized pattern results since the last call
+ *   and reset the counters. Nothing is reported if no regexp was applied.
+ */
+void rdr_memoinfo(rdr_t *rdr) {
+	pat_memo_t *memo = rdr->ws.memo;
+	if (memo == NULL || memo->hit + memo->miss == 0)
+		return;
+	const uint64_t tot = memo->hit + memo->miss;
+	info("pattern cache: %"PRIu64"/%"PRIu64" hits (%.2f%%)",
+		memo->hit, tot, memo->hit * 100.0 / tot);
+	memo->hit = memo->miss = 0;
+}
+
 /* rdr_load:
  *   Read from the given file a reader saved previously with rdr_save. The given
  *   reader must be empty, comming fresh from rdr_new. Be carefull that this
  *   function performs almost no checks on the input data, so if you modify the
  *   reader and make a mistake, it will probably result in a crash.
+ *   If mapped is set, binary observations are mapped read-only from the file
+ *   instead of being loaded in memory, see qrk_map.
  */
 void rdr_load(rdr_t *rdr, FILE *file) {
 	const char *err = "broken file, invalid reader format";
 	int autouni = rdr->autouni;
 	fpos_t pos;
 	fgetpos(file, &pos);
-	if (fscanf(file, "#rdr#%"PRIu32"/%"PRIu32"/%d\n",
-			&rdr->npats, &rdr->ntoks, &autouni) != 3) {
-		// This for compatibility with previous file format
+	rdr->nbkt = 0;
+	if (fscanf(file, "#rdr#%"SCNu32"/%"SCNu32"/%d/%"SCNu64"\n",
+			&rdr->npats, &rdr->ntoks, &autouni, &rdr->nbkt) != 4) {
+		// This for compatibility with previous file formats
 		fsetpos(file, &pos);
-		if (fscanf(file, "#rdr#%"PRIu32"/%"PRIu32"\n",
-				&rdr->npats, &rdr->ntoks) != 2)
-			fatal(err);
+		rdr->nbkt = 0;
+		if (fscanf(file, "#rdr#%"PRIu32"/%"PRIu32"/%d\n",
+				&rdr->npats, &rdr->ntoks, &autouni) != 3) {
+			fsetpos(file, &pos);
+			if (fscanf(file, "#rdr#%"PRIu32"/%"PRIu32"\n",
+					&rdr->npats, &rdr->ntoks) != 2)
+				fatal("%s", err);
+		}
 	}
 	rdr->autouni = autouni;
 	rdr->nuni = rdr->nbi = 0;
+	rdr_dropfid(rdr);
 	if (rdr->npats != 0) {
 		rdr->pats = wapiti_xmalloc(sizeof(pat_t *) * rdr->npats);
 		for (uint32_t p = 0; p < rdr->npats; p++) {
@@ -546,22 +1610,421 @@ void rdr_load(rdr_t *rdr, FILE *file) {
 				          rdr->nbi++;  break;
 			}
 		}
+		rdr_setpats(rdr);
 	}
 	qrk_load(rdr->lbl, file);
-	qrk_load(rdr->obs, file);
+	if (rdr->mapped)
+		qrk_map(rdr->obs, file);
+	else
+		qrk_load(rdr->obs, file);
 }
 
 /* rdr_save:
  *   Save the reader to the given file so it can be loaded back. The save format
- *   is plain text and portable accros computers.
+ *   is plain text and portable accros computers. If binary is set, the
+ *   observations quark, which is by far the biggest part, is saved in the
+ *   binary form which is much faster to load but still portable.
+ *   The bucket count is only written for hashed readers so other models can
+ *   still be read by previous versions.
  */
 void rdr_save(const rdr_t *rdr, FILE *file) {
-	if (fprintf(file, "#rdr#%"PRIu32"/%"PRIu32"/%d\n",
-			rdr->npats, rdr->ntoks, rdr->autouni) < 0)
+	int res;
+	if (rdr->nbkt != 0)
+		res = fprintf(file, "#rdr#%"PRIu32"/%"PRIu32"/%d/%"PRIu64"\n",
+			rdr->npats, rdr->ntoks, rdr->autouni, rdr->nbkt);
+	else
+		res = fprintf(file, "#rdr#%"PRIu32"/%"PRIu32"/%d\n",
+			rdr->npats, rdr->ntoks, rdr->autouni);
+	if (res < 0)
 		pfatal("cannot write to file");
 	for (uint32_t p = 0; p < rdr->npats; p++)
 		ns_writestr(file, rdr->pats[p]->src);
 	qrk_save(rdr->lbl, file);
-	qrk_save(rdr->obs, file);
+	if (rdr->binary)
+		qrk_savebin(rdr->obs, file);
+	else
+		qrk_save(rdr->obs, file);
+}
+
+
+/*******************************************************************************
+ * Dataset cache
+ *
+ *   Reading a dataset requires tokenizing it, applying all the patterns and
+ *   interning all the observations, which has to be redone each time the same
+ *   corpus is used to train a new model. A fully interned dataset can instead
+ *   be saved in a binary cache file together with the reader used to build
+ *   it, and loaded back with a few large reads.
+ *
+ *   The cache start with a "#wbin#" line followed by the reader in the usual
+ *   format, with the observations in binary form, and next the dataset itself
+ *   as a small header followed by the arrays of sequence lengths, of labels
+ *   and observations counts for each position, and of all the observations
+ *   identifiers. Deduplicated datasets also store the weights of sequences
+ *   just after their lengths, this is flagged in the header so caches without
+ *   weights keep the same format. These arrays are stored in the host byte
+ *   order, so a cache is not portable and is rejected if read on a different
+ *   platform. They are also padded to their natural alignment so they can be
+ *   used in place when the cache is mapped in memory for streaming.
+ *
+ *   As the identifiers stored are only meaningful for the reader saved with
+ *   them, they are translated through the keys of its quarks when the cache is
+ *   loaded, so a cache can be loaded in any reader: the translation is the
+ *   identity for a new one and the labels and observations are added to an
+ *   existing one as if the data were read from text.
+ ******************************************************************************/
+
+/* rdr_wbinchk:
+ *   Value stored in the header of the cache to detect byte order mismatch.
+ */
+static const uint32_t rdr_wbinchk = 0x77626e32;
+
+/* rdr_write, rdr_read:
+ *   Write or read a binary block, failing violently on error.
+ */
+static void rdr_write(FILE *file, const void *ptr, size_t size) {
+	if (size != 0 && fwrite(ptr, size, 1, file) != 1)
+		pfatal("cannot write to file");
+}
+static void rdr_read(FILE *file, void *ptr, size_t size) {
+	if (size != 0 && fread(ptr, size, 1, file) != 1) {
+		if (ferror(file))
+			pfatal("cannot read from file");
+		fatal("broken file, invalid dataset cache");
+	}
+}
+
+/* rdr_iswbin:
+ *   Check if the file is a dataset cache without moving its position. Files
+ *   which cannot be seeked, like pipes, are never considered as caches.
+ */
+bool rdr_iswbin(FILE *file) {
+	char buf[6];
+	const long off = ftell(file);
+	if (off < 0)
+		return false;
+	const size_t len = fread(buf, 1, sizeof(buf), file);
+	if (fseek(file, off, SEEK_SET) != 0)
+		pfatal("cannot read from file");
+	return len == sizeof(buf) && !memcmp(buf, "#wbin#", sizeof(buf));
+}
+
+/* rdr_savedat:
+ *   Save the dataset and the reader it was read with in a cache file.
+ */
+void rdr_savedat(const rdr_t *rdr, const dat_t *dat, FILE *file) {
+	if (fprintf(file, "#wbin#\n") < 0)
+		pfatal("cannot write to file");
+	rdr_t tmp = *rdr;
+	tmp.binary = true;
+	rdr_save(&tmp, file);
+	// Flatten the positions of all the sequences in arrays
+	uint64_t P = 0, I = 0;
+	for (uint32_t s = 0; s < dat->nseq; s++) {
+		const seq_t *seq = dat->seq[s];
+		P += seq->len;
+		for (uint32_t t = 0; t < seq->len; t++)
+			I += seq->pos[t].ucnt + seq->pos[t].bcnt;
+	}
+	uint32_t *len = wapiti_xmalloc(sizeof(uint32_t) * max(dat->nseq, 1));
+	uint32_t *wgt = wapiti_xmalloc(sizeof(uint32_t) * max(dat->nseq, 1));
+	uint32_t *cnt = wapiti_xmalloc(sizeof(uint32_t) * max(P, 1) * 3);
+	uint32_t *ids = wapiti_xmalloc(sizeof(uint32_t) * max(I, 1));
+	uint64_t p = 0, i = 0;
+	bool weighted = false;
+	for (uint32_t s = 0; s < dat->nseq; s++) {
+		const seq_t *seq = dat->seq[s];
+		len[s] = seq->len;
+		wgt[s] = seq->weight;
+		if (seq->weight != 1)
+			weighted = true;
+		for (uint32_t t = 0; t < seq->len; t++, p++) {
+			const pos_t *pos = &seq->pos[t];
+			cnt[p * 3 + 0] = pos->lbl;
+			cnt[p * 3 + 1] = pos->ucnt;
+			cnt[p * 3 + 2] = pos->bcnt;
+			memcpy(ids + i, pos->uobs, sizeof(uint32_t) * pos->ucnt);
+			i += pos->ucnt;
+			memcpy(ids + i, pos->bobs, sizeof(uint32_t) * pos->bcnt);
+			i += pos->bcnt;
+		}
+	}
+	// And write them after the header. The padding needed to align them
+	// can only be computed if the file position is known, else the cache
+	// can still be loaded but not streamed.
+	const uint8_t zero[4] = {0};
+	const long off = ftell(file);
+	uint32_t pad = 0;
+	if (off >= 0)
+		pad = (4 - (off + 16 + 16) % 4) % 4;
+	const uint32_t flg = (dat->lbl ? 1 : 0) | (weighted ? 2 : 0);
+	const uint32_t hdr[4] = {rdr_wbinchk, dat->nseq, flg, pad};
+	const uint64_t siz[2] = {P, I};
+	rdr_write(file, hdr, sizeof(hdr));
+	rdr_write(file, siz, sizeof(siz));
+	rdr_write(file, zero, pad);
+	rdr_write(file, len, sizeof(uint32_t) * dat->nseq);
+	if (weighted)
+		rdr_write(file, wgt, sizeof(uint32_t) * dat->nseq);
+	rdr_write(file, cnt, sizeof(uint32_t) * P * 3);
+	rdr_write(file, ids, sizeof(uint32_t) * I);
+	free(len);
+	free(wgt);
+	free(cnt);
+	free(ids);
+}
+
+/* rdr_remapqrk:
+ *   Return an array mapping the identifiers of the <src> quark to the ones of
+ *   the same keys in the <dst> quark, interning them if it is not locked.
+ */
+static uint64_t *rdr_remapqrk(qrk_t *dst, const qrk_t *src) {
+	const uint64_t N = qrk_count(src);
+	uint64_t *map = wapiti_xmalloc(sizeof(uint64_t) * max(N, 1));
+	for (uint64_t n = 0; n < N; n++) {
+		map[n] = qrk_str2id(dst, qrk_id2str(src, n));
+		if (map[n] != none && map[n] >= UINT32_MAX)
+			fatal("too many observations for 32 bits identifiers");
+	}
+	return map;
 }
 
+/* rdr_isident:
+ *   Check if a mapping returned by rdr_remapqrk is the identity.
+ */
+static bool rdr_isident(const uint64_t *map, uint64_t N) {
+	for (uint64_t n = 0; n < N; n++)
+		if (map[n] != n)
+			return false;
+	return true;
+}
+
+/* rdr_mapdat:
+ *   Map the arrays of a dataset cache, starting at the current position of
+ *   <file>, and return a dataset streaming its sequences from the mapping.
+ *   The identifiers must be valid for the reader without translation, they
+ *   are only checked to be in range. Return NULL without moving the file
+ *   position if the mapping is not possible.
+ */
+static dat_t *rdr_mapdat(FILE *file, const uint32_t hdr[4], uint64_t P,
+                         uint64_t I, uint64_t nlbl, uint64_t nobs) {
+#ifdef MAP_ANSI
+	unused(file && hdr && P && I && nlbl && nobs);
+	return NULL;
+#else
+	const uint32_t S = hdr[1];
+	const uint64_t W = (hdr[2] & 2) ? S : 0;
+	const uint64_t need = sizeof(uint32_t) * (S + W + P * 3 + I);
+	struct stat st;
+	const off_t off = ftello(file);
+	if (off < 0 || off % 4 != 0 || fstat(fileno(file), &st) != 0)
+		return NULL;
+	if (!S_ISREG(st.st_mode))
+		return NULL;
+	if ((uint64_t)st.st_size < off + need)
+		fatal("broken file, invalid dataset cache");
+	const off_t pgsz = sysconf(_SC_PAGESIZE);
+	const off_t base = off - off % pgsz;
+	const size_t size = off - base + need;
+	void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), base);
+	if (addr == MAP_FAILED)
+		return NULL;
+	const uint32_t *len = (const uint32_t *)((char *)addr + (off - base));
+	const uint32_t *wgt = len + S;
+	const uint32_t *cnt = wgt + W;
+	const uint32_t *ids = cnt + P * 3;
+	dat_t *dat = wapiti_xmalloc(sizeof(dat_t));
+	dat->lbl  = hdr[2] & 1;
+	dat->nseq = S;
+	dat->mlen = 0;
+	dat->seq  = NULL;
+	dat->blk  = NULL;
+	dat->ord  = NULL;
+	dat->cost = NULL;
+	dat->map.addr = addr;
+	dat->map.size = size;
+	dat->map.cnt  = cnt;
+	dat->map.ids  = ids;
+	dat->map.wgt  = W != 0 ? wgt : NULL;
+	dat->map.off  = wapiti_xmalloc(sizeof(uint64_t) * (S + 1) * 2);
+	// Compute the offsets of each sequence and check all the identifiers
+	// as the trainers will use them blindly. This also bring the cache in
+	// the page cache if it fit.
+	uint64_t p = 0, i = 0;
+	for (uint32_t s = 0; s < S; s++) {
+		dat->map.off[s * 2 + 0] = p;
+		dat->map.off[s * 2 + 1] = i;
+		const uint32_t T = len[s];
+		if (p + T > P || (W != 0 && wgt[s] == 0))
+			fatal("broken file, invalid dataset cache");
+		for (uint32_t t = 0; t < T; t++, p++) {
+			const uint32_t *c = cnt + p * 3;
+			if (c[0] != (uint32_t)-1 && c[0] >= nlbl)
+				fatal("broken file, invalid dataset cache");
+			if (i + c[1] + c[2] > I)
+				fatal("broken file, invalid dataset cache");
+			for (uint32_t n = c[1] + c[2]; n != 0; n--, i++)
+				if (ids[i] >= nobs)
+					fatal("broken file, invalid dataset cache");
+		}
+		dat->mlen = max(dat->mlen, T);
+	}
+	dat->map.off[S * 2 + 0] = p;
+	dat->map.off[S * 2 + 1] = i;
+	fseeko(file, off + need, SEEK_SET);
+	return dat;
+#endif
+}
+
+/* rdr_loaddat:
+ *   Load a dataset from a cache file saved with rdr_savedat. The labels and
+ *   observations of the cache are interned in the given reader, and if it has
+ *   no patterns yet, it also get the ones the cache was built with. Return
+ *   NULL if the cache is empty.
+ *   If the reader stream flag is set and the identifiers of the cache are the
+ *   same in the reader, which is the case if it was empty, the cache is mapped
+ *   instead of loaded so datasets larger than memory can be used for training.
+ */
+dat_t *rdr_loaddat(rdr_t *rdr, FILE *file) {
+	char buf[7];
+	rdr_read(file, buf, sizeof(buf));
+	if (memcmp(buf, "#wbin#\n", sizeof(buf)))
+		fatal("broken file, invalid dataset cache");
+	rdr_t *src = rdr_new(false);
+	src->mapped = true;
+	rdr_load(src, file);
+	// Hashed observations have no keys so they cannot be translated, the
+	// buckets must match or the reader must still be empty.
+	if (src->nbkt != rdr->nbkt) {
+		if (rdr->nbkt != 0 || qrk_count(rdr->obs) != 0)
+			fatal("dataset cache and reader use different buckets");
+		rdr->nbkt = src->nbkt;
+	}
+	if (rdr->npats == 0 && qrk_count(rdr->obs) == 0)
+		rdr->autouni = src->autouni;
+	if (rdr->npats == 0 && src->npats != 0) {
+		rdr->pats  = src->pats;
+		rdr->npats = src->npats;
+		rdr->nuni  = src->nuni;
+		rdr->nbi   = src->nbi;
+		rdr->ntoks = src->ntoks;
+		src->pats  = NULL;
+		src->npats = 0;
+		rdr_setpats(rdr);
+	}
+	uint64_t *lmap = rdr_remapqrk(rdr->lbl, src->lbl);
+	uint64_t *omap = NULL;
+	if (rdr->nbkt == 0)
+		omap = rdr_remapqrk(rdr->obs, src->obs);
+	const uint64_t nlbl = qrk_count(src->lbl);
+	const uint64_t nobs = qrk_count(src->obs);
+	rdr_free(src);
+	// Read the header and the flat arrays
+	uint32_t hdr[4];
+	uint64_t siz[2];
+	rdr_read(file, hdr, sizeof(hdr));
+	if (hdr[0] != rdr_wbinchk)
+		fatal("dataset cache built on a different platform");
+	rdr_read(file, siz, sizeof(siz));
+	const uint32_t S = hdr[1];
+	const uint64_t P = siz[0], I = siz[1];
+	if (hdr[2] > 3 || hdr[3] >= 4)
+		fatal("broken file, invalid dataset cache");
+	uint8_t pad[4];
+	rdr_read(file, pad, hdr[3]);
+	if (rdr->stream && S != 0) {
+		dat_t *dat = NULL;
+		if (rdr_isident(lmap, nlbl) && (omap == NULL || rdr_isident(omap, nobs)))
+			dat = rdr_mapdat(file, hdr, P, I, nlbl,
+				omap == NULL ? rdr->nbkt : nobs);
+		if (dat != NULL) {
+			free(lmap);
+			free(omap);
+			return dat;
+		}
+		warning("cannot stream the dataset cache, loading it in memory");
+	}
+	uint32_t *len = wapiti_xmalloc(sizeof(uint32_t) * max(S, 1));
+	uint32_t *wgt = NULL;
+	uint32_t *cnt = wapiti_xmalloc(sizeof(uint32_t) * max(P, 1) * 3);
+	uint32_t *ids = wapiti_xmalloc(sizeof(uint32_t) * max(I, 1));
+	rdr_read(file, len, sizeof(uint32_t) * S);
+	if (hdr[2] & 2) {
+		wgt = wapiti_xmalloc(sizeof(uint32_t) * max(S, 1));
+		rdr_read(file, wgt, sizeof(uint32_t) * S);
+	}
+	rdr_read(file, cnt, sizeof(uint32_t) * P * 3);
+	rdr_read(file, ids, sizeof(uint32_t) * I);
+	// Now rebuild the sequences, translating the identifiers on the fly.
+	// Observations unknown to a locked reader are dropped as they would be
+	// when reading the text data.
+	dat_t *dat = wapiti_xmalloc(sizeof(dat_t));
+	dat->lbl  = hdr[2] & 1;
+	dat->nseq = S;
+	dat->mlen = 0;
+	dat->seq  = wapiti_xmalloc(sizeof(seq_t *) * max(S, 1));
+	dat->blk  = NULL;
+	dat->ord  = NULL;
+	dat->cost = NULL;
+	dat->map.addr = NULL;
+	uint64_t p = 0, i = 0;
+	for (uint32_t s = 0; s < S; s++) {
+		const uint32_t T = len[s];
+		uint64_t n = 0;
+		if (p + T > P)
+			fatal("broken file, invalid dataset cache");
+		for (uint32_t t = 0; t < T; t++)
+			n += cnt[(p + t) * 3 + 1] + cnt[(p + t) * 3 + 2];
+		if (i + n > I)
+			fatal("broken file, invalid dataset cache");
+		seq_t *seq = rdr_datseq(dat, T, n);
+		if (wgt != NULL) {
+			if (wgt[s] == 0)
+				fatal("broken file, invalid dataset cache");
+			seq->weight = wgt[s];
+		}
+		uint32_t *raw = seq->raw;
+		for (uint32_t t = 0; t < T; t++, p++) {
+			pos_t *pos = &seq->pos[t];
+			const uint32_t lbl = cnt[p * 3 + 0];
+			pos->lbl = (uint32_t)-1;
+			if (lbl != (uint32_t)-1) {
+				if (lbl >= nlbl)
+					fatal("broken file, invalid dataset cache");
+				if (lmap[lbl] != none)
+					pos->lbl = lmap[lbl];
+			}
+			for (int k = 0; k < 2; k++) {
+				const uint32_t c = cnt[p * 3 + 1 + k];
+				uint32_t *obs = raw;
+				for (uint32_t o = 0; o < c; o++, i++) {
+					uint64_t id = ids[i];
+					if (omap != NULL) {
+						if (id >= nobs)
+							fatal("broken file, invalid dataset cache");
+						id = omap[id];
+					}
+					if (id != none)
+						*raw++ = id;
+				}
+				if (k == 0)
+					pos->uobs = obs, pos->ucnt = raw - obs;
+				else
+					pos->bobs = obs, pos->bcnt = raw - obs;
+			}
+		}
+		dat->seq[s] = seq;
+		dat->mlen = max(dat->mlen, T);
+	}
+	free(len);
+	free(wgt);
+	free(cnt);
+	free(ids);
+	free(lmap);
+	free(omap);
+	if (S == 0) {
+		rdr_freedat(dat);
+		return NULL;
+	}
+	return dat;
+}
@@ -36,39 +36,104 @@
 #include "quark.h"
 #include "sequence.h"
 
+typedef struct rdr_fid_s rdr_fid_t;
+
 /* rdr_t:
  *   The reader object who hold all informations needed to parse the input file:
  *   the patterns and quark for labels and observations. We keep separate count
  *   for unigrams and bigrams pattern for simpler allocation of sequences. We
  *   also store the expected number of column in the input data to check that
  *   pattern are appliables.
+ *   If nbkt is not zero, observations are not interned in the quark but hashed
+ *   in one of the nbkt buckets which are used as their identifiers.
+ *   The <in> structure describe the input file mapped by rdr_mapin, if any.
+ *   If stream is set, dataset caches are mapped instead of being loaded in
+ *   memory when possible, see rdr_loaddat.
+ *   If tokid is set, observations are identified from the tokens they are
+ *   built from without building their strings when possible, see rdr_fidobs.
+ *   The <ws> structure is the workspace where raw sequences are tokenized, it
+ *   grows as needed and is reused for all the sequences converted with this
+ *   reader so a reader must not be used by several threads at once.
  */
 typedef struct rdr_s rdr_t;
 struct rdr_s {
 	bool       autouni;    //      Automatically add 'u' prefix
+	bool       binary;     //      Save observations in binary form
+	bool       mapped;     //      Map binary observations when loading
+	bool       stream;     //      Map dataset caches when loading
+	bool       tokid;      //      Map observations by token identifiers
 	uint32_t   npats;      //  P   Total number of patterns
 	uint32_t   nuni, nbi;  //      Number of unigram and bigram patterns
 	uint32_t   ntoks;      //      Expected number of tokens in input
+	uint32_t   nrex;       //      Number of distinct regexps in patterns
+	uint32_t   ncmd;       //  C   Number of distinct commands in patterns
+	uint64_t   nbkt;       //      Number of observation buckets if hashed
+	struct {
+		FILE       *file;  //      Input file currently mapped
+		void       *addr;  //      Start of the mapping
+		size_t      size;  //      Size of the mapping
+		const char *pos;   //      Next line to read
+		const char *end;   //      End of the input data
+	} in;
+	struct {
+		tok_t      *tok;   //      Tokenized sequence
+		uint32_t    tsize; //      Number of positions in <tok>
+		char       *chr;   //      Copies of the raw lines
+		size_t      csize; //      Size of <chr>
+		char      **ptr;   //      Tokens of all the positions
+		size_t      psize; //      Size of <ptr>
+		char       *obs;   //      Observation built by the patterns
+		size_t      osize; //      Size of <obs>
+		pat_memo_t *memo;  //      Memoized results of the patterns
+		rdr_fid_t  *fid;   //      Observations by token identifiers
+		pat_res_t  *res;   // [C]  Results of the commands at a position
+		char       *low;   //      Results of the commands without caps
+		size_t      lsize; //      Size of <low>
+		seq_t      *seq;   //      Sequence being built if interrupted
+		char        err[512]; //   Error of a failed rdr_raw2seqs
+	} ws;
 	pat_t    **pats;       // [P]  List of precompiled patterns
+	pat_item_t **cmds;     // [C]  Distinct commands of the patterns
 	qrk_t     *lbl;        //      Labels database
 	qrk_t     *obs;        //      Observation database
 };
 
 rdr_t *rdr_new(bool autouni);
 void rdr_free(rdr_t *rdr);
+raw_t *rdr_newraw(uint32_t T);
 void rdr_freeraw(raw_t *raw);
 void rdr_freeseq(seq_t *seq);
 void rdr_freedat(dat_t *dat);
+void rdr_packdat(dat_t *dat, uint32_t from);
+seq_t *rdr_seqbuf(const dat_t *dat);
+const seq_t *rdr_getseq(const dat_t *dat, uint32_t s, seq_t *buf);
+uint32_t rdr_dedupdat(dat_t *dat);
+void rdr_appenddat(dat_t *dat, dat_t *src);
+void rdr_sched(dat_t *dat);
 
 void rdr_loadpat(rdr_t *rdr, FILE *file);
+bool rdr_mapin(rdr_t *rdr, FILE *file);
+void rdr_unmapin(rdr_t *rdr);
 raw_t *rdr_readraw(rdr_t *rdr, FILE *file);
 seq_t *rdr_raw2seq(rdr_t *rdr, const raw_t *raw, bool lbl);
 seq_t *rdr_readseq(rdr_t *rdr, FILE *file, bool lbl);
-dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl);
+bool rdr_raw2seqs(rdr_t *rdr, raw_t *const *raw, seq_t **seq, uint32_t n,
+                  bool lbl, uint32_t W);
+dat_t *rdr_readdat(rdr_t *rdr, FILE *file, bool lbl, uint32_t W);
+
+rdr_t *rdr_fork(const rdr_t *rdr);
+void rdr_dropfork(rdr_t *stg);
+void rdr_join(rdr_t *rdr, rdr_t *stg, seq_t **seq, uint32_t nseq);
+void rdr_memoinfo(rdr_t *rdr);
+void rdr_dropfid(rdr_t *rdr);
 
 void rdr_load(rdr_t *rdr, FILE *file);
 void rdr_save(const rdr_t *rdr, FILE *file);
 
+bool rdr_iswbin(FILE *file);
+void rdr_savedat(const rdr_t *rdr, const dat_t *dat, FILE *file);
+dat_t *rdr_loaddat(rdr_t *rdr, FILE *file);
+
 char *rdr_readline(FILE *file);
 
 #endif
@@ -170,7 +170,7 @@ void trn_rprop(mdl_t *mdl) {
 		int type;
 		uint64_t nftr;
 		if (fscanf(file, "#state#%d#%"SCNu64"\n", &type, &nftr) != 2)
-			fatal(err);
+			fatal("%s", err);
 		if (type != 3)
 			fatal("state is not for rprop model");
 		for (uint64_t i = 0; i < nftr; i++) {
@@ -178,7 +178,7 @@ void trn_rprop(mdl_t *mdl) {
 			double vxp, vstp, vgp;
 			if (fscanf(file, "%"PRIu64" %le %le %le\n", &f, &vxp,
 					&vstp, &vgp) != 4)
-				fatal(err);
+				fatal("%s", err);
 			if (wbt && !cut) xp[f] = vxp;
 			gp[f] = vgp;
 			stp[f] = vstp;
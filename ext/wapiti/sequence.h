@@ -67,14 +67,18 @@
  *   output the sequence as it was read in the labelling mode.
  *
  *   This represent a sequence of lengths <len> and for each position 't' you
- *   find the corresponding line at <lines>[t].
+ *   find the corresponding line at <lines>[t] and its length, without the end
+ *   of line, at <lens>[t]. Lines are not required to be nul-terminated.
  *
- *   The <lines> array is allocated with data structure, and the different lines
- *   are allocated separatly.
+ *   The <lines> and <lens> arrays are allocated with data structure by the
+ *   rdr_newraw function. The different lines are either allocated separatly
+ *   or, if <mapped> is true, point directly in a memory mapped input file.
  */
 typedef struct raw_s raw_t;
 struct raw_s {
 	uint32_t  len;      //   T     Sequence length
+	bool      mapped;   //         Lines point in a mapped file
+	uint32_t *lens;     //  [T]    Length of each line
 	char     *lines[];  //  [T]    Raw lines directly from file
 };
 
@@ -87,9 +91,10 @@ struct raw_s {
  *   the eventual label provided in input file, and at <toks>[t] a list of
  *   string tokens of length <cnts>[t].
  *
- *   Memory allocation here is a bit special as the first token at each position
- *   point to a memory block who hold a copy of the raw line. Each other tokens
- *   and the label are pointer in this block. This reduce memory fragmentation.
+ *   Memory allocation here is a bit special as tok_t objects only live in the
+ *   workspace of the reader: the tokens and labels point in a single buffer
+ *   holding a copy of all the raw lines, and the tokens lists are slices of a
+ *   single array of pointers. This avoid any allocation while tokenizing.
  */
 typedef struct tok_s tok_t;
 struct tok_s {
@@ -119,16 +124,26 @@ struct tok_s {
  *   The raw field is private and used internaly for efficient memory
  *   allocation. This allow to allocate <lbl>, <*cnt>, and all the list in
  *   <*obs> with the datastructure itself.
+ *
+ *   Observations identifiers are stored on 32 bits as this is far enough in
+ *   practice and halve the memory used by datasets and the bytes read by the
+ *   gradient and decoding loops. The reader refuse to build more.
+ *
+ *   The <weight> is the number of identical sequences of the dataset this one
+ *   stand for, it is always 1 unless the dataset was deduplicated with
+ *   rdr_dedupdat, and the trainers and evaluation count the sequence as many
+ *   times as its weight.
  */
 typedef struct pos_s pos_t;
 typedef struct seq_s seq_t;
 struct seq_s {
 	uint32_t  len;
-	uint64_t *raw;
+	uint32_t  weight;
+	uint32_t *raw;
 	struct pos_s {
 		uint32_t  lbl;
 		uint32_t  ucnt,  bcnt;
-		uint64_t *uobs, *bobs;
+		uint32_t *uobs, *bobs;
 	} pos[];
 };
 
@@ -138,13 +153,45 @@ struct seq_s {
  *   sequence length as the trainer need this for memory allocation. The dataset
  *   contains <nseq> sequence stored in <seq>. These sequences are labeled only
  *   if <lbl> is true.
+ *
+ *   The sequences of a dataset are allocated contiguously in load order in the
+ *   blocks of its <blk> arena, so iterating over them is cache friendly and
+ *   the whole dataset is released by freeing a few blocks.
+ *
+ *   A dataset can also be streamed from a dataset cache mapped in memory, in
+ *   which case <seq> is NULL and the <map> structure describe the flat arrays
+ *   of the cache. The pos_t arrays of each sequence are rebuilt on demand by
+ *   rdr_getseq pointing directly to the observations in the mapping, so only
+ *   the offsets of each sequence are kept in memory.
+ *
+ *   The <ord> and <cost> arrays are built by rdr_sched for the workers which
+ *   process the sequences longest first with batches of equal cost.
  */
+typedef struct dat_blk_s dat_blk_t;
+struct dat_blk_s {
+	dat_blk_t *next;  //         Previously filled block
+	size_t     size;  //         Size of the block data
+	size_t     used;  //         Number of bytes already allocated
+	char       data[];
+};
+
 typedef struct dat_s dat_t;
 struct dat_s {
 	bool       lbl;   //         True iff sequences are labelled
 	uint32_t   mlen;  //         Length of the longest sequence in the set
 	uint32_t   nseq;  //   S     Number of sequences in the set
 	seq_t    **seq;   //  [S]    List of sequences
+	dat_blk_t *blk;   //         Arena holding the sequences
+	uint32_t  *ord;   //  [S]    Sequences by decreasing length or NULL
+	uint64_t  *cost;  //  [S+1]  Cumulated cost of sequences in this order
+	struct {
+		void           *addr;  //         Start of the mapping or NULL
+		size_t          size;  //         Size of the mapping
+		const uint32_t *cnt;   // [P][3]  Label and observations counts
+		const uint32_t *ids;   // [I]     Observations identifiers
+		const uint32_t *wgt;   // [S]     Sequences weights or NULL
+		uint64_t       *off;   // [S+1][2] Offsets of sequences in both
+	} map;
 };
 
 #endif
@@ -36,6 +36,7 @@
 #include "model.h"
 #include "options.h"
 #include "progress.h"
+#include "reader.h"
 #include "sequence.h"
 #include "tools.h"
 
@@ -90,6 +91,9 @@ static void sgd_add(uint64_t *obs, uint32_t *cnt, uint64_t new) {
 
 /* trn_sgdl1:
  *   Train the model with the SGD-l1 algorithm described by tsurukoa et al.
+ *   Deduplicated datasets are refused: with a decaying learning rate and the
+ *   cumulative penalty, a single step scaled by the weight of a sequence is
+ *   not the same as one step for each of its copies.
  */
 void trn_sgdl1(mdl_t *mdl) {
 	const uint64_t  Y = mdl->nlbl;
@@ -99,6 +103,12 @@ void trn_sgdl1(mdl_t *mdl) {
 	const uint32_t  S = mdl->train->nseq;
 	const uint32_t  K = mdl->opt->maxiter;
 	      double   *w = mdl->theta;
+	seq_t *buf = rdr_seqbuf(mdl->train);
+	for (uint32_t s = 0; s < S; s++)
+		if (rdr_getseq(mdl->train, s, buf)->weight != 1) {
+			free(buf);
+			fatal("sgd-l1 cannot train on deduplicated sequences");
+		}
 	// First we have to build and index who hold, for each sequences, the
 	// list of actives observations.
 	// The index is a simple table indexed by sequences number. Each entry
@@ -107,7 +117,7 @@ void trn_sgdl1(mdl_t *mdl) {
 	info("build the index");
 	sgd_idx_t *idx  = wapiti_xmalloc(sizeof(sgd_idx_t) * S);
 	for (uint32_t s = 0; s < S; s++) {
-		const seq_t *seq = mdl->train->seq[s];
+		const seq_t *seq = rdr_getseq(mdl->train, s, buf);
 		const uint32_t T = seq->len;
 		uint64_t uobs[U * T + 1];
 		uint64_t bobs[B * T + 1];
@@ -165,7 +175,7 @@ void trn_sgdl1(mdl_t *mdl) {
 		// And so, we can process sequence in a random order
 		for (uint32_t sp = 0; sp < S && !uit_stop; sp++, i++) {
 			const uint32_t s = perm[sp];
-			const seq_t *seq = mdl->train->seq[s];
+			const seq_t *seq = rdr_getseq(mdl->train, s, buf);
 			grd_dospl(grd_st, seq);
 			// Before applying the gradient, we have to compute the
 			// learning rate to apply to this sequence. For this we
@@ -213,6 +223,7 @@ void trn_sgdl1(mdl_t *mdl) {
 	}
 	free(idx);
 	free(perm);
+	free(buf);
 	free(g);
 	free(q);
 }
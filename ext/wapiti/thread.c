@@ -26,6 +26,7 @@
  */
 
 #include <stdint.h>
+#include <time.h>
 
 #include "model.h"
 #include "tools.h"
@@ -50,6 +51,16 @@
  *   be completed like gradient computation which depend on the length of the
  *   sequences.
  *   If you provide a count of 0, the job system is disabled.
+ *
+ *   When the cost of each job can be estimated, mth_spawncost hand out batches
+ *   by estimated cost instead of by count. Each batch is worth at most the
+ *   cost of <batch> average jobs and at most half the remaining work divided
+ *   by the number of workers, so batches get smaller toward the end. With the
+ *   jobs sorted by decreasing cost, the long sequences are done first and the
+ *   last batches hold a few short ones, so the workers finish at almost the
+ *   same time instead of waiting for the one which got the last batch of long
+ *   sequences. It also accumulate the time each worker spent in the function
+ *   and the total time of the call, so the idle time can be reported.
  ******************************************************************************/
 #ifdef MTH_ANSI
 struct job_s {
@@ -65,14 +76,20 @@ bool mth_getjob(job_t *job, uint32_t *cnt, uint32_t *pos) {
 	return true;
 }
 
-void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch) {
-	unused(batch);
+double mth_spawncost(func_t *f, uint32_t W, void *ud[W], uint32_t size,
+                     uint32_t batch, const uint64_t *cost, double *busy) {
+	unused(batch && cost);
+	const clock_t beg = clock();
 	if (size == 0) {
 		f(NULL, 0, 1, ud[0]);
 	} else {
 		job_t job = {size};
 		f(&job, 0, 1, ud[0]);
 	}
+	const double wall = (double)(clock() - beg) / CLOCKS_PER_SEC;
+	if (busy != NULL)
+		busy[0] += wall;
+	return wall;
 }
 
 #else
@@ -83,6 +100,9 @@ struct job_s {
 	uint32_t size;
 	uint32_t send;
 	uint32_t batch;
+	uint32_t nwrk;
+	const uint64_t *cost;
+	uint64_t quantum;
 	pthread_mutex_t lock;
 };
 
@@ -93,14 +113,27 @@ struct mth_s {
 	uint32_t  cnt;
 	func_t   *f;
 	void     *ud;
+	double    busy;
 };
 
+/* mth_now:
+ *   Return a monotonic time in seconds for measuring workers activity.
+ */
+static double mth_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 /* mth_getjob:
  *   Get a new bunch of sequence to process. This function will return a new
  *   batch of sequence to process starting at position <pos> and with size
  *   <cnt> and return true. If no more batch are available, return false.
  *   This function use a lock to ensure thread safety as it will be called by
  *   the multiple workers threads.
+ *   With a cost array, the batch extend up to the first job where the cumulated
+ *   cost reach its share of the remaining work, so it always hold at least one
+ *   job.
  */
 bool mth_getjob(job_t *job, uint32_t *cnt, uint32_t *pos) {
 	if (job == NULL)
@@ -108,7 +141,27 @@ bool mth_getjob(job_t *job, uint32_t *cnt, uint32_t *pos) {
 	if (job->send == job->size)
 		return false;
 	pthread_mutex_lock(&job->lock);
-	*cnt = min(job->batch, job->size - job->send);
+	if (job->send == job->size) {
+		pthread_mutex_unlock(&job->lock);
+		return false;
+	}
+	if (job->cost != NULL) {
+		const uint64_t *cost = job->cost;
+		const uint64_t left = cost[job->size] - cost[job->send];
+		const uint64_t share = min(job->quantum, left / (2 * job->nwrk));
+		const uint64_t lim = cost[job->send] + max(share, 1);
+		uint32_t lo = job->send + 1, hi = job->size;
+		while (lo < hi) {
+			const uint32_t mid = lo + (hi - lo) / 2;
+			if (cost[mid] >= lim)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		*cnt = lo - job->send;
+	} else {
+		*cnt = min(job->batch, job->size - job->send);
+	}
 	*pos = job->send;
 	job->send += *cnt;
 	pthread_mutex_unlock(&job->lock);
@@ -117,16 +170,25 @@ bool mth_getjob(job_t *job, uint32_t *cnt, uint32_t *pos) {
 
 static void *mth_stub(void *ud) {
 	mth_t *mth = (mth_t *)ud;
+	const double beg = mth_now();
 	mth->f(mth->job, mth->id, mth->cnt, mth->ud);
+	mth->busy = mth_now() - beg;
 	return NULL;
 }
 
-/* mth_spawn:
+/* mth_spawncost:
  *   This function spawn W threads for calling the 'f' function. The function
  *   will get a unique identifier between 0 and W-1 and a user data from the
  *   'ud' array.
+ *   If <cost> is not NULL, it give the cumulated cost of the jobs, with the
+ *   cost of the first <n> ones in cost[n], and batches are handed out by cost
+ *   with each one worth as much as <batch> jobs of average cost. If <busy> is
+ *   not NULL, the time spent by each worker is added to it. Return the time
+ *   the call took in seconds.
  */
-void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch) {
+double mth_spawncost(func_t *f, uint32_t W, void *ud[W], uint32_t size,
+                     uint32_t batch, const uint64_t *cost, double *busy) {
+	const double beg = mth_now();
 	// First prepare the jobs scheduler
 	job_t job, *pjob = NULL;
 	if (size != 0) {
@@ -134,6 +196,11 @@ void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch
 		job.size = size;
 		job.send = 0;
 		job.batch = batch;
+		job.nwrk = W;
+		job.cost = cost;
+		job.quantum = 0;
+		if (cost != NULL)
+			job.quantum = max(cost[size] * batch / size, 1);
 		if (pthread_mutex_init(&job.lock, NULL) != 0)
 			fatal("failed to create mutex");
 	}
@@ -141,17 +208,21 @@ void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch
 	// for efficiency.
 	if (W == 1) {
 		f(&job, 0, 1, ud[0]);
-		return;
+		const double wall = mth_now() - beg;
+		if (busy != NULL)
+			busy[0] += wall;
+		return wall;
 	}
 	// We prepare the parameters structures that will be send to the threads
 	// with informations for calling the user function.
 	mth_t p[W];
 	for (uint32_t w = 0; w < W; w++) {
-		p[w].job = pjob;
-		p[w].id  = w;
-		p[w].cnt = W;
-		p[w].f   = f;
-		p[w].ud  = ud[w];
+		p[w].job  = pjob;
+		p[w].id   = w;
+		p[w].cnt  = W;
+		p[w].f    = f;
+		p[w].ud   = ud[w];
+		p[w].busy = 0.0;
 	}
 	// We are now ready to spawn the threads and wait for them to finish
 	// their jobs. So we just create all the thread and try to join them
@@ -168,6 +239,16 @@ void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch
 		if (pthread_join(th[w], NULL) != 0)
 			fatal("failed to join thread");
 	pthread_attr_destroy(&attr);
+	if (busy != NULL)
+		for (uint32_t w = 0; w < W; w++)
+			busy[w] += p[w].busy;
+	return mth_now() - beg;
 }
 #endif
 
+/* mth_spawn:
+ *   Spawn the workers with batches of <batch> jobs and no time accounting.
+ */
+void mth_spawn(func_t *f, uint32_t W, void *ud[W], uint32_t size, uint32_t batch) {
+	mth_spawncost(f, W, ud, size, batch, NULL, NULL);
+}
@@ -64,6 +64,42 @@ FILE *ufopen(VALUE path, const char *mode) {
  *   around it and realloc who check and fail in case of error.
  ******************************************************************************/
 
+/* wrktrap:
+ *   Ruby exceptions can only be raised from Ruby threads, so a worker thread
+ *   which may hit an error, like bad input found while loading data in
+ *   parallel, have to set a trap first with setjmp on <trap>->env. Errors
+ *   raised by the worker store their message in the trap and jump back to it,
+ *   so the worker can stop and let the main thread raise the error. Calling it
+ *   with NULL remove the trap.
+ */
+static __thread trap_t *wrk_trap = NULL;
+
+void wrktrap(trap_t *trap) {
+	wrk_trap = trap;
+}
+
+/* wrkthrow:
+ *   Store the error message in the trap of the current worker thread and jump
+ *   back to it. A worker without trap cannot recover and just print the
+ *   message before aborting.
+ */
+__attribute__((noreturn, format(printf, 1, 0)))
+static void wrkthrow(const char *fmt, va_list args, const char *err) {
+	trap_t *trap = wrk_trap;
+	if (trap == NULL) {
+		fprintf(stderr, "wapiti: ");
+		vfprintf(stderr, fmt, args);
+		if (err != NULL)
+			fprintf(stderr, ": %s", err);
+		fprintf(stderr, "\n");
+		abort();
+	}
+	int len = vsnprintf(trap->msg, sizeof(trap->msg), fmt, args);
+	if (err != NULL && len >= 0 && (size_t)len < sizeof(trap->msg))
+		snprintf(trap->msg + len, sizeof(trap->msg) - len, ": %s", err);
+	longjmp(trap->env, 1);
+}
+
 /* fatal:
  *   This is the main error function, it will print the given message with same
  *   formating than the printf family and exit program with an error. We let the
@@ -73,6 +109,8 @@ __attribute__((noreturn)) void fatal(const char *fmt, ...) {
   VALUE msg;
 	va_list args;
 	va_start(args, fmt);
+	if (!ruby_native_thread_p())
+		wrkthrow(fmt, args, NULL);
   msg = rb_vsprintf(fmt, args);
 	va_end(args);
 	rb_raise(cNativeError, "%s", StringValueCStr(msg));
@@ -90,6 +128,8 @@ __attribute__((noreturn)) void pfatal(const char *fmt, ...) {
   VALUE msg;
 	va_list args;
 	va_start(args, fmt);
+	if (!ruby_native_thread_p())
+		wrkthrow(fmt, args, err);
   msg = rb_vsprintf(fmt, args);
 	va_end(args);
 	rb_str_catf(msg, ": %s", err);
@@ -27,6 +27,7 @@
 #ifndef tools_h
 #define tools_h
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -41,10 +42,23 @@
 #undef max
 #define max(a, b) ((a) < (b) ? (b) : (a))
 
+/* trap_t:
+ *   Landing point for the errors raised by a worker thread, see wrktrap.
+ */
+typedef struct trap_s trap_t;
+struct trap_s {
+	jmp_buf env;       // Where fatal jump back in the worker
+	char    msg[512];  // Message of the error
+};
+
 FILE *ufopen(VALUE path, const char *mode);
 
-void fatal(const char *fmt, ...);
-void pfatal(const char *fmt, ...);
+void wrktrap(trap_t *trap);
+
+void fatal(const char *fmt, ...)
+	__attribute__((noreturn, format(printf, 1, 2)));
+void pfatal(const char *fmt, ...)
+	__attribute__((noreturn, format(printf, 1, 2)));
 void warning(const char *fmt, ...);
 void info(const char *fmt, ...);
 
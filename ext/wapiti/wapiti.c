@@ -97,7 +97,7 @@ void dotrain(mdl_t *mdl) {
 	// Load a previous model to train again if specified by the user.
 	if (mdl->opt->model != NULL) {
 		info("* Load previous model\n");
-		FILE *file = fopen(mdl->opt->model, "r");
+		FILE *file = fopen(mdl->opt->model, "rb");
 		if (file == NULL)
 			pfatal("cannot open input model file");
 		mdl_load(mdl, file);
@@ -113,23 +113,39 @@ void dotrain(mdl_t *mdl) {
 		fclose(file);
 		qrk_lock(mdl->reader->obs, false);
 	}
+	// Switch to feature hashing if requested. The buckets of a previous
+	// model cannot be changed as this would make its weights meaningless.
+	if (mdl->opt->buckets != 0 && mdl->opt->buckets != mdl->reader->nbkt) {
+		if (mdl->theta != NULL)
+			fatal("cannot change the buckets of a previous model");
+		mdl->reader->nbkt = mdl->opt->buckets;
+	}
 	// Load the training data. When this is done we lock the quarks as we
 	// don't want to put in the model, informations present only in the
 	// devlopment set.
 	info("* Load training data\n");
+	qrk_hashed(mdl->reader->obs, mdl->opt->hashed);
 	FILE *file = stdin;
 	if (mdl->opt->input != NULL) {
 		file = fopen(mdl->opt->input, "r");
 		if (file == NULL)
 			pfatal("cannot open input data file");
 	}
-	mdl->train = rdr_readdat(mdl->reader, file, true);
+	// Only the training set is streamed, the development set is loaded
+	// after the quarks are filled and so could not be mapped anyway.
+	mdl->reader->stream = mdl->opt->stream;
+	mdl->train = rdr_readdat(mdl->reader, file, true, mdl->opt->nthread);
+	mdl->reader->stream = false;
 	if (mdl->opt->input != NULL)
 		fclose(file);
 	qrk_lock(mdl->reader->lbl, true);
 	qrk_lock(mdl->reader->obs, true);
 	if (mdl->train == NULL || mdl->train->nseq == 0)
 		fatal("no train data loaded");
+	if (mdl->opt->dedup) {
+		const uint32_t cnt = rdr_dedupdat(mdl->train);
+		info("    %8"PRIu32" duplicate sequences merged\n", cnt);
+	}
 	// If present, load the development set in the model. If not specified,
 	// the training dataset will be used instead.
 	if (mdl->opt->devel != NULL) {
@@ -137,7 +153,8 @@ void dotrain(mdl_t *mdl) {
 		FILE *file = fopen(mdl->opt->devel, "r");
 		if (file == NULL)
 			pfatal("cannot open development file");
-		mdl->devel = rdr_readdat(mdl->reader, file, true);
+		mdl->devel = rdr_readdat(mdl->reader, file, true,
+			mdl->opt->nthread);
 		fclose(file);
 	}
 	// Initialize the model. If a previous model was loaded, this will be
@@ -173,10 +190,11 @@ void dotrain(mdl_t *mdl) {
 	info("* Save the model\n");
 	file = stdout;
 	if (mdl->opt->output != NULL) {
-		file = fopen(mdl->opt->output, "w");
+		file = fopen(mdl->opt->output, "wb");
 		if (file == NULL)
 			pfatal("cannot open output model");
 	}
+	mdl->reader->binary = mdl->opt->binary;
 	mdl_save(mdl, file);
 	if (mdl->opt->output != NULL)
 		fclose(file);
@@ -192,10 +210,14 @@ void dolabel(mdl_t *mdl) {
 	if (mdl->opt->model == NULL)
 		fatal("you must specify a model");
 	info("* Load model\n");
-	FILE *file = fopen(mdl->opt->model, "r");
+	FILE *file = fopen(mdl->opt->model, "rb");
 	if (file == NULL)
 		pfatal("cannot open input model file");
+	mdl->reader->mapped = mdl->opt->mapped;
 	mdl_load(mdl, file);
+	if (mdl->opt->perfect)
+		qrk_perfect(mdl->reader->obs, true);
+	mdl->reader->tokid = mdl->opt->tokid;
 	// Open input and output files
 	FILE *fin = stdin, *fout = stdout;
 	if (mdl->opt->input != NULL) {
@@ -227,7 +249,7 @@ static void dodump(mdl_t *mdl) {
 	info("* Load model\n");
 	FILE *fin = stdin;
 	if (mdl->opt->input != NULL) {
-		fin = fopen(mdl->opt->input, "r");
+		fin = fopen(mdl->opt->input, "rb");
 		if (fin == NULL)
 			pfatal("cannot open input data file");
 	}
@@ -241,16 +263,21 @@ static void dodump(mdl_t *mdl) {
 		if (fout == NULL)
 			pfatal("cannot open output data file");
 	}
-	// Dump model
+	// Dump model. Observations of hashed models are only known by their
+	// bucket number which is dumped instead.
 	info("* Dump model\n");
 	const uint32_t Y = mdl->nlbl;
 	const uint64_t O = mdl->nobs;
 	const qrk_t *Qlbl = mdl->reader->lbl;
 	const qrk_t *Qobs = mdl->reader->obs;
-	char fmt[16];
+	char fmt[16], bkt[32];
 	sprintf(fmt, "%%.%df\n", mdl->opt->prec);
 	for (uint64_t o = 0; o < O; o++) {
-		const char *obs = qrk_id2str(Qobs, o);
+		const char *obs = bkt;
+		if (mdl->reader->nbkt != 0)
+			sprintf(bkt, "%"PRIu64, o);
+		else
+			obs = qrk_id2str(Qobs, o);
 		bool empty = true;
 		if (mdl->kind[o] & 1) {
 			const double *w = mdl->theta + mdl->uoff[o];
@@ -268,9 +295,11 @@ static void dodump(mdl_t *mdl) {
 			for (uint32_t d = 0; d < Y * Y; d++) {
 				if (!mdl->opt->all && w[d] == 0.0)
 					continue;
-				const char *ly  = qrk_id2str(Qlbl, d % Y);
-				const char *lyp = qrk_id2str(Qlbl, d / Y);
-				fprintf(fout, "%s\t%s\t%s\t", obs, lyp, ly);
+				// Label strings are only valid until the
+				// next call to qrk_id2str on the same quark.
+				fprintf(fout, "%s\t", obs);
+				fprintf(fout, "%s\t", qrk_id2str(Qlbl, d / Y));
+				fprintf(fout, "%s\t", qrk_id2str(Qlbl, d % Y));
 				fprintf(fout, fmt, w[d]);
 				empty = false;
 			}
@@ -291,7 +320,7 @@ void doupdt(mdl_t *mdl) {
 	info("* Load model\n");
 	if (mdl->opt->model == NULL)
 		fatal("no model file provided");
-	FILE *Min = fopen(mdl->opt->model, "r");
+	FILE *Min = fopen(mdl->opt->model, "rb");
 	if (Min == NULL)
 		pfatal("cannot open model file %s", mdl->opt->model);
 	mdl_load(mdl, Min);
@@ -336,7 +365,13 @@ void doupdt(mdl_t *mdl) {
 		// Parse the tokens, the first three should be string maping to
 		// observations and labels and the last should be the weight.
 		uint64_t obs = none, yp = none, y = none;
-		obs = qrk_str2id(mdl->reader->obs, toks[0]);
+		if (mdl->reader->nbkt != 0) {
+			if (sscanf(toks[0], "%"SCNu64, &obs) != 1
+					|| obs >= mdl->nobs)
+				obs = none;
+		} else {
+			obs = qrk_str2id(mdl->reader->obs, toks[0]);
+		}
 		if (obs == none)
 			fatal("bad on observation on line %d", nline);
 		if (strcmp(toks[1], "#")) {
@@ -376,16 +411,64 @@ void doupdt(mdl_t *mdl) {
 	info("* Save the model\n");
 	FILE *file = stdout;
 	if (mdl->opt->output != NULL) {
-		file = fopen(mdl->opt->output, "w");
+		file = fopen(mdl->opt->output, "wb");
 		if (file == NULL)
 			pfatal("cannot open output model");
 	}
+	mdl->reader->binary = mdl->opt->binary;
 	mdl_save(mdl, file);
 	if (mdl->opt->output != NULL)
 		fclose(file);
 	info("* Done\n");
 }
 
+/*******************************************************************************
+ * Caching
+ ******************************************************************************/
+static void docache(mdl_t *mdl) {
+	// Load the patterns if provided, the dataset will be read exactly as
+	// it would be for training.
+	if (mdl->opt->pattern != NULL) {
+		info("* Load patterns\n");
+		FILE *file = fopen(mdl->opt->pattern, "r");
+		if (file == NULL)
+			pfatal("cannot open pattern file");
+		rdr_loadpat(mdl->reader, file);
+		fclose(file);
+	}
+	mdl->reader->nbkt = mdl->opt->buckets;
+	// Read the dataset
+	info("* Load data\n");
+	FILE *fin = stdin;
+	if (mdl->opt->input != NULL) {
+		fin = fopen(mdl->opt->input, "r");
+		if (fin == NULL)
+			pfatal("cannot open input data file");
+	}
+	dat_t *dat = rdr_readdat(mdl->reader, fin, true, mdl->opt->nthread);
+	if (mdl->opt->input != NULL)
+		fclose(fin);
+	if (dat == NULL)
+		fatal("no data loaded");
+	if (mdl->opt->dedup) {
+		const uint32_t cnt = rdr_dedupdat(dat);
+		info("    %8"PRIu32" duplicate sequences merged\n", cnt);
+	}
+	// And save it with the reader in the cache file
+	info("* Save the cache\n");
+	FILE *fout = stdout;
+	if (mdl->opt->output != NULL) {
+		fout = fopen(mdl->opt->output, "wb");
+		if (fout == NULL)
+			pfatal("cannot open output cache file");
+	}
+	rdr_savedat(mdl->reader, dat, fout);
+	if (mdl->opt->output != NULL)
+		fclose(fout);
+	rdr_freedat(dat);
+	info("* Done\n");
+}
+
 /*******************************************************************************
  * Entry point
  ******************************************************************************/
@@ -402,6 +485,7 @@ int wapiti_main(int argc, char *argv[argc]) {
 		case 1: dolabel(mdl); break;
 		case 2: dodump(mdl);  break;
 		case 3: doupdt(mdl);  break;
+		case 4: docache(mdl); break;
 	}
 	// And cleanup
 	mdl_free(mdl);
@@ -48,6 +48,16 @@
  */
 //#define ATM_ANSI
 
+/* MAP_ANSI:
+ *   By uncomenting the following define, you can disable the use of memory
+ *   mapped files to load frozen models, for non-POSIX systems. This is always
+ *   the case on Windows.
+ */
+//#define MAP_ANSI
+#ifdef _WIN32
+#define MAP_ANSI
+#endif
+
 /* Without multi-threading we disable atomic updates as they are not needed and
  * can only decrease performances in this case.
  */
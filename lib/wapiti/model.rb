@@ -10,8 +10,8 @@ module Wapiti
         new(config).train(training_data, development_data)
       end
 
-      def load(filename)
-        model = new
+      def load(filename, options = {})
+        model = new(options)
         model.path = filename
         model.load
       end
@@ -74,6 +74,22 @@ module Wapiti
       end
     end
 
+    alias native_cache cache
+
+    def cache(data, path, opts = nil)
+      options.update!(opts) unless opts.nil?
+      data = data.to_a(tagged: true) if data.is_a?(Dataset)
+      native_cache(data, path)
+    end
+
+    alias native_append append
+
+    def append(data, opts = nil)
+      options.update!(opts) unless opts.nil?
+      data = data.to_a(tagged: true) if data.is_a?(Dataset)
+      native_append(data)
+    end
+
     def statistics
       {
         token: {
@@ -111,6 +127,6 @@ module Wapiti
       sequence_errors / sequence_count.to_f * 100.0
     end
 
-    private :native_label, :native_train
+    private :native_label, :native_train, :native_cache, :native_append
   end
 end
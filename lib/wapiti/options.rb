@@ -4,14 +4,20 @@ module Wapiti
 
     @attribute_names = %w{
       algorithm
+      binary
+      buckets
       check
       compact
       compress
       convergence_window
+      dedup
+      hashed
       jobsize
       max_iterations
       maxent
+      mmap
       pattern
+      perfect
       posterior
       rho1
       rho2
@@ -20,7 +26,9 @@ module Wapiti
       sparse
       stop_epsilon
       stop_window
+      stream
       threads
+      tokid
       type
     }.map(&:to_sym).freeze
 
@@ -131,7 +139,7 @@ module Wapiti
         e << "invalid value for #{name}: #{send(name)}" unless send(name) > 0
       end
 
-      %w{ rho1 rho2 }.each do |name|
+      %w{ buckets rho1 rho2 }.each do |name|
         e << "invalid value for #{name}: #{send(name)}" unless send(name) >= 0.0
       end
 
@@ -141,7 +149,7 @@ module Wapiti
       e
     end
 
-    %w{ maxent compact sparse label check score posterior compress }.each do |m|
+    %w{ maxent mmap perfect tokid compact binary hashed stream dedup sparse label check score posterior compress }.each do |m|
       writer = "#{m}=".to_sym
       define_method("#{m}!") do
         send(writer, true)
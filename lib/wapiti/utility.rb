@@ -6,8 +6,8 @@ module Wapiti
     Model.train(data, options, &block)
   end
 
-  def load(model)
-    Model.load(model)
+  def load(model, options = {})
+    Model.load(model, options)
   end
 
   module_function :train, :load
@@ -38,7 +38,30 @@ module Fixtures
   end
 end
 
+module Logging
+  # Returns the messages logged at info level while the block runs.
+  def capture_info
+    messages = []
+    Wapiti::Logger.define_singleton_method(:info) { |msg| messages << msg }
+    begin
+      yield
+    ensure
+      Wapiti::Logger.singleton_class.send(:remove_method, :info)
+    end
+    messages
+  end
+end
+
+module Labels
+  # Returns the labels the model gives to each sequence of the input.
+  def labels_of(model, input, opts = nil)
+    model.label(input, opts).map { |s| s.map(&:label) }
+  end
+end
+
 RSpec.configure do |config|
   config.include(FileUtils)
   config.include(Fixtures)
+  config.include(Logging)
+  config.include(Labels)
 end
@@ -105,6 +105,21 @@ module Wapiti
         expect(model.train(training_data, nil, threads: 2).nlbl).to eq(6)
       end
 
+      it 'reports the activity of each thread' do
+        messages = capture_info {
+          model.train(training_data, nil, threads: 2, max_iterations: 3)
+        }
+        expect(messages.grep(/\Athread \d: busy [0-9.]+s idle [0-9.]+s\z/).size).to eq(2)
+      end
+
+      it 'raises errors found by the loading threads' do
+        data = File.read(training_data).split(/\n\s*\n/).map { |s| s.lines.map(&:chomp) }
+        data << ['missing']
+        expect {
+          Model.new(:pattern => pattern).train(data, nil, threads: 2)
+        }.to raise_error(NativeError, /missing tokens/)
+      end
+
       it 'accepts a data array' do
         data = []
         seq = []
@@ -125,6 +140,193 @@ module Wapiti
         expect(model.train(data).nlbl).to eq(6)
       end
 
+      context 'with the hashed option set' do
+        let(:reference) { Model.new(:pattern => pattern).train(training_data) }
+
+        it 'interns the same observations as the default quark' do
+          model.options.hashed = true
+          model.train(training_data)
+          expect(model.nobs).to eq(reference.nobs)
+          expect(model.nftr).to eq(reference.nftr)
+        end
+
+        it 'saves a model which can be loaded back' do
+          model.options.hashed = true
+          model.options.binary = true
+          model.train(training_data)
+
+          Tempfile.open('model') do |file|
+            model.save(file.path)
+            expect(Wapiti.load(file.path).nobs).to eq(reference.nobs)
+          end
+        end
+      end
+
+      context 'with the buckets option set' do
+        let(:input) { [%w{ 1 2 3 2 }] }
+
+        it 'hashes the observations in the given number of buckets' do
+          model.options.buckets = 4096
+          model.train(training_data)
+          expect(model.nobs).to eq(4096)
+          expect(model.label(input)[0].size).to eq(4)
+        end
+
+        it 'saves a model without observations which can be loaded back' do
+          model.options.buckets = 4096
+          model.train(training_data)
+
+          Tempfile.open('model') do |file|
+            model.save(file.path)
+            expect(File.read(file.path)).not_to include(':*3:1,')
+            copy = Wapiti.load(file.path)
+            expect(copy.nobs).to eq(4096)
+            expect(labels_of(copy, input)).to eq(labels_of(model, input))
+          end
+        end
+      end
+
+      context 'with a dataset cache' do
+        let(:reference) { Model.new(:pattern => pattern).train(training_data) }
+        let(:input) { [%w{ 1 2 3 2 }] }
+
+        it 'trains the same model as the original data' do
+          Tempfile.open('wbin') do |file|
+            Model.new(:pattern => pattern).cache(training_data, file.path)
+            expect(File.read(file.path, 6)).to eq('#wbin#')
+
+            model = Model.new
+            model.train(file.path)
+            expect(model.nlbl).to eq(reference.nlbl)
+            expect(model.nobs).to eq(reference.nobs)
+            expect(model.nftr).to eq(reference.nftr)
+            expect(labels_of(model, input)).to eq(labels_of(reference, input))
+          end
+        end
+
+        it 'streams the cache with the stream option set' do
+          Tempfile.open('wbin') do |file|
+            Model.new(:pattern => pattern).cache(training_data, file.path)
+
+            model = Model.new(:stream => true, :max_iterations => 10)
+            model.train(file.path)
+            copy = Model.new(:pattern => pattern, :max_iterations => 10)
+            copy.train(training_data)
+            expect(model.nobs).to eq(copy.nobs)
+            expect(labels_of(model, input)).to eq(labels_of(copy, input))
+          end
+        end
+      end
+
+      context 'with the dedup option set' do
+        let(:input) { [%w{ 1 2 3 2 }] }
+
+        it 'trains the same model on duplicated data' do
+          Tempfile.open('train') do |file|
+            file.write(File.read(training_data) * 3)
+            file.flush
+
+            model = Model.new(:pattern => pattern, :dedup => true,
+              :max_iterations => 10)
+            model.train(file.path)
+            copy = Model.new(:pattern => pattern, :max_iterations => 10)
+            copy.train(file.path)
+            expect(model.nobs).to eq(copy.nobs)
+            expect(model.nftr).to eq(copy.nftr)
+            expect(labels_of(model, input)).to eq(labels_of(copy, input))
+          end
+        end
+
+        it 'is refused by sgd-l1' do
+          expect {
+            Model.new(:pattern => pattern, :dedup => true,
+              :algorithm => 'sgd-l1').train(training_data)
+          }.to raise_error(NativeError, /deduplicated/)
+        end
+
+        it 'keeps the weights of sequences in a dataset cache' do
+          Tempfile.open('wbin') do |file|
+            data = File.readlines(training_data, "\n\n").map { |s|
+              s.split("\n") } * 2
+            Model.new(:pattern => pattern, :dedup => true).cache(data, file.path)
+            plain = Tempfile.new('wbin')
+            Model.new(:pattern => pattern).cache(data, plain.path)
+            expect(File.size(file.path)).to be < File.size(plain.path)
+
+            model = Model.new(:stream => true, :max_iterations => 10)
+            model.train(file.path)
+            copy = Model.new(:max_iterations => 10)
+            copy.train(plain.path)
+            expect(labels_of(model, input)).to eq(labels_of(copy, input))
+            plain.close!
+          end
+        end
+      end
+
+      context 'with appended data' do
+        let(:input) { [%w{ 1 2 3 2 }] }
+        let(:data) {
+          File.readlines(training_data, "\n\n").map { |s| s.split("\n") }
+        }
+
+        it 'trains again on the whole dataset' do
+          model = Model.new(:pattern => pattern, :max_iterations => 10)
+          model.train(data[0, 100])
+          model.append(data[100..-1])
+          model.train(nil)
+
+          copy = Model.new(:pattern => pattern, :max_iterations => 10)
+          copy.train(data)
+          expect(model.nlbl).to eq(copy.nlbl)
+          expect(model.nobs).to eq(copy.nobs)
+          expect(model.nftr).to eq(copy.nftr)
+          expect(model.label(input)[0].size).to eq(4)
+        end
+
+        it 'trains a new model on appended data' do
+          model = Model.new(:pattern => pattern, :buckets => 4096,
+            :max_iterations => 10)
+          model.append(data)
+          model.train(nil)
+
+          copy = Model.new(:pattern => pattern, :buckets => 4096,
+            :max_iterations => 10)
+          copy.train(data)
+          expect(model.nobs).to eq(copy.nobs)
+          expect(model.nftr).to eq(copy.nftr)
+          expect(labels_of(model, input)).to eq(labels_of(copy, input))
+        end
+
+        it 'fails to train again without a dataset' do
+          expect { Model.new(:pattern => pattern).train(nil) }.to raise_error(NativeError)
+        end
+
+        it 'fails to append no data' do
+          expect { Model.new(:pattern => pattern).append([]) }.to raise_error(NativeError)
+        end
+
+        it 'trains again after an invalid development set' do
+          model = Model.new(:pattern => pattern, :max_iterations => 3)
+          model.train(data[0, 100], data[100, 20])
+          expect { model.train(nil, [['missing']]) }.to raise_error(NativeError)
+          expect(model.train(nil, data[100, 20]).nlbl).to eq(6)
+        end
+      end
+
+      context 'when training a maxent model without a pattern' do
+        let(:model) { Model.new(:maxent => true, :type => 'maxent') }
+        let(:data) {
+          [['sunny hot no'], ['rain mild yes'], ['sunny mild no'],
+           ['overcast hot yes'], ['rain cool yes']]
+        }
+
+        it 'uses the tokens as unigram observations' do
+          model.train(data)
+          expect(model.nobs).to eq(6)
+          expect(labels_of(model, [['sunny hot'], ['rain cool']])).to eq([%w{ no }, %w{ yes }])
+        end
+      end
+
       context 'when called without a pattern' do
         it 'fails because of wapiti' do
           expect {
@@ -225,6 +427,66 @@ module Wapiti
             expect(dataset.size).to eq(77)
             expect(dataset[0].take(5).map(&:label)).to eq(%w{ B-NP B-PP B-NP I-NP B-VP })
           end
+
+          it 'reports the hit rate of the pattern cache' do
+            messages = capture_info { model.label(input) }
+            expect(messages.grep(/\Apattern cache: \d+\/\d+ hits \([0-9.]+%\)\z/).size).to eq(1)
+          end
+
+          context 'with the :perfect option set' do
+            it 'returns the same labels' do
+              expect(labels_of(model, input, perfect: true)).to eq(labels_of(model, input))
+            end
+          end
+
+          context 'with the :tokid option set' do
+            it 'returns the same labels' do
+              expect(labels_of(model, input, tokid: true)).to eq(labels_of(model, input))
+            end
+
+            it 'returns the same labels after compaction' do
+              model = Model.new(:pattern => pattern, :max_iterations => 10)
+              model.train(training_data)
+              labels_of(model, training_data, tokid: true)
+              model.compact
+              expect(labels_of(model, training_data, tokid: true)).to eq(
+                labels_of(model, training_data))
+            end
+          end
+        end
+      end
+    end
+
+    describe '#save' do
+      let(:model) { Wapiti.load(fixture('ch.mod')) }
+      let(:input) { [['Hello NN B-VP', ', , O', 'world NN B-NP', '! ! O']] }
+      let(:file) { Tempfile.new('model') }
+
+      after(:each) { file.close! }
+
+      context 'with the binary option set' do
+        before(:each) { model.options.binary = true }
+
+        it 'saves a model which can be loaded back' do
+          model.save(file.path)
+          copy = Wapiti.load(file.path)
+
+          expect(copy.nlbl).to eq(model.nlbl)
+          expect(copy.nobs).to eq(model.nobs)
+          expect(copy.labels).to eq(model.labels)
+          expect(labels_of(copy, input)).to eq(labels_of(model, input))
+        end
+
+        it 'saves a model which can be mapped back read-only' do
+          model.save(file.path)
+          copy = Wapiti.load(file.path, :mmap => true)
+
+          expect(copy.options).to be_mmap
+          expect(copy.nobs).to eq(model.nobs)
+          expect(labels_of(copy, input)).to eq(labels_of(model, input))
+
+          copy.save(file.path)
+          expect(Wapiti.load(file.path).nobs).to eq(model.nobs)
         end
       end
     end
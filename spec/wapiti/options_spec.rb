@@ -75,6 +75,27 @@ module Wapiti
       end
     end
 
+    describe '#buckets' do
+      it 'returns 0 by default' do
+        expect(options.buckets).to eq(0)
+      end
+    end
+
+    describe '#buckets=' do
+      it 'sets buckets to the given value' do
+        expect { options.buckets = 1024 }.to change { options.buckets }.to(1024)
+      end
+
+      it 'fails for negative values' do
+        expect { options.buckets = -1 }.to raise_error(ArgumentError)
+        expect(options.buckets).to eq(0)
+      end
+
+      it 'fails for values which are not numbers' do
+        expect { options.buckets = 'foo' }.to raise_error(TypeError)
+      end
+    end
+
     describe '#maxiter' do
       it 'returns a large number by default' do
         # TODO figure out why win32 defaults to -1
@@ -150,7 +171,7 @@ module Wapiti
     end
 
 
-    %w{ maxent compact sparse skip_tokens check score posterior }.each do |m|
+    %w{ maxent mmap perfect tokid compact binary hashed stream dedup sparse skip_tokens check score posterior }.each do |m|
       describe "##{m}" do
         it 'returns false by default' do
           expect(options.send(m)).to be false